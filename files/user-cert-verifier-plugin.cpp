@@ -0,0 +1,79 @@
+// same checks as user-cert-verifier.py, as a --cert-verifier-plugin
+#include <algorithm>
+#include <array>
+#include <ctime>
+#include <optional>
+#include <string_view>
+
+#include "cert-verifier-plugin.h"
+
+namespace {
+const auto allowed_users = std::array{std::string_view("origin")};
+
+auto parse_date(const std::string_view str) -> std::optional<time_t> {
+    if(str.size() != 8 || str.find_first_not_of("0123456789") != str.npos) {
+        return std::nullopt;
+    }
+    const auto num = [str](const size_t pos, const size_t len) {
+        auto value = 0;
+        for(const auto c : str.substr(pos, len)) {
+            value = value * 10 + (c - '0');
+        }
+        return value;
+    };
+    auto tm     = std::tm();
+    tm.tm_year  = num(0, 4) - 1900;
+    tm.tm_mon   = num(4, 2) - 1;
+    tm.tm_mday  = num(6, 2);
+    tm.tm_isdst = -1;
+    if(tm.tm_mon < 0 || tm.tm_mon > 11 || tm.tm_mday < 1 || tm.tm_mday > 31) {
+        return std::nullopt;
+    }
+    return std::mktime(&tm); // local time, like datetime.strptime()
+}
+} // namespace
+
+extern "C" {
+int plink_cert_verifier_init(void) {
+    return 0;
+}
+
+int plink_cert_verifier_verify(const char* const content, const size_t content_size, int64_t* const valid_until) {
+    auto user   = std::string_view();
+    auto expire = std::string_view();
+    for(auto rest = std::string_view(content, content_size); !rest.empty();) {
+        const auto lf   = rest.find('\n');
+        const auto line = rest.substr(0, lf);
+        rest            = lf == rest.npos ? std::string_view() : rest.substr(lf + 1);
+        if(line.empty()) {
+            continue;
+        }
+        const auto eq = line.find('=');
+        if(eq == line.npos || line.find('=', eq + 1) != line.npos) {
+            return 0; // illformed line
+        }
+        const auto key   = line.substr(0, eq);
+        const auto value = line.substr(eq + 1);
+        if(key == "user") {
+            user = value;
+        } else if(key == "expire") {
+            expire = value;
+        } else {
+            return 0; // unknown key
+        }
+    }
+
+    if(user.empty() || std::ranges::find(allowed_users, user) == allowed_users.end()) {
+        return 0;
+    }
+    const auto expire_time = parse_date(expire);
+    if(!expire_time || *expire_time == -1 || std::time(nullptr) >= *expire_time) {
+        return 0;
+    }
+    *valid_until = *expire_time;
+    return 1;
+}
+
+void plink_cert_verifier_shutdown(void) {
+}
+}
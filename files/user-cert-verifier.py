@@ -3,50 +3,87 @@ import sys
 import datetime
 
 
+class VerifyError(Exception):
+    pass
+
+
 def panic(*args):
-    print(*args)
-    exit(1)
+    raise VerifyError(" ".join(map(str, args)))
 
 
-user = None
-expire = None
-for line in sys.argv[1].split("\n"):
-    if len(line) == 0:
-        continue
-    elms = line.split("=")
-    if len(elms) != 2:
-        panic("illformed line:", line)
-
-    key, value = elms
-    match key:
-        case "user":
-            user = value
-            pass
-        case "expire":
-            expire = value
-            pass
-        case _:
-            panic("unknown key:", line)
-
-# user check
-if not user:
-    panic("no user key")
-
-if not user in ["origin"]:
-    panic("unallowed user:", user)
-
-# expire check
-if not expire:
-    panic("no expire key")
+def verify(content):
+    user = None
+    expire = None
+    for line in content.split("\n"):
+        if len(line) == 0:
+            continue
+        elms = line.split("=")
+        if len(elms) != 2:
+            panic("illformed line:", line)
 
-try:
-    expire = datetime.datetime.strptime(expire, "%Y%m%d")
-except:
-    panic("invalid expire date format")
+        key, value = elms
+        match key:
+            case "user":
+                user = value
+                pass
+            case "expire":
+                expire = value
+                pass
+            case _:
+                panic("unknown key:", line)
+
+    # user check
+    if not user:
+        panic("no user key")
+
+    if not user in ["origin"]:
+        panic("unallowed user:", user)
+
+    # expire check
+    if not expire:
+        panic("no expire key")
+
+    try:
+        expire = datetime.datetime.strptime(expire, "%Y%m%d")
+    except:
+        panic("invalid expire date format")
 
-now = datetime.datetime.now()
-if now >= expire:
-    panic("expired:", expire)
+    now = datetime.datetime.now()
+    if now >= expire:
+        panic("expired:", expire)
+
+    return user, int(expire.timestamp())
+
+
+# worker mode for --cert-verifier-pool
+# request:  "<content length>\n<content>"
+# response: "ok valid-until=<unix time>\n" or "ng <reason>\n"
+def run_pool():
+    stdin = sys.stdin.buffer
+    while True:
+        header = stdin.readline()
+        if not header:
+            return
+        content = stdin.read(int(header))
+        try:
+            _, valid_until = verify(content.decode())
+            print(f"ok valid-until={valid_until}", flush=True)
+        except UnicodeDecodeError:
+            print("ng not utf-8", flush=True)
+        except VerifyError as e:
+            print("ng", e, flush=True)
+
+
+if len(sys.argv) == 2 and sys.argv[1] == "--pool":
+    run_pool()
+    exit(0)
+
+try:
+    user, valid_until = verify(sys.argv[1])
+except VerifyError as e:
+    print(e)
+    exit(1)
 
 print("verified user", user)
+print(f"valid-until={valid_until}")
 exit(0)
@@ -0,0 +1,71 @@
+#include <algorithm>
+#include <cstring>
+
+#include "admission.hpp"
+
+namespace plink {
+auto TokenBucket::refill(const RateLimit& limit, const std::chrono::steady_clock::time_point now) -> void {
+    if(last == std::chrono::steady_clock::time_point()) {
+        tokens = limit.burst;
+    } else {
+        const auto elapsed = std::chrono::duration<double>(now - last).count();
+        tokens             = std::min(limit.burst, tokens + elapsed * limit.rate);
+    }
+    last = now;
+}
+
+auto TokenBucket::take(const RateLimit& limit, const std::chrono::steady_clock::time_point now) -> bool {
+    refill(limit, now);
+    if(tokens < 1) {
+        return false;
+    }
+    tokens -= 1;
+    return true;
+}
+
+auto Admission::admit_accept() -> bool {
+    if(!accept.enabled() || accept_bucket.take(accept, std::chrono::steady_clock::now())) {
+        return true;
+    }
+    refused_accepts += 1;
+    return false;
+}
+
+auto Admission::IdentityHash::operator()(const Identity& identity) const -> size_t {
+    auto hash = size_t();
+    std::memcpy(&hash, identity.data(), sizeof(hash));
+    return hash;
+}
+
+auto Admission::admit_activation(const Identity& identity) -> bool {
+    if(!activation.enabled()) {
+        return true;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    auto       it  = activation_index.find(identity);
+    if(it == activation_index.end()) {
+        if(activation_buckets.size() >= max_identities) {
+            // forgetting an identity only refills its bucket, so evict instead of refusing newcomers
+            activation_index.erase(activation_buckets.back().identity);
+            activation_buckets.pop_back();
+        }
+        activation_buckets.push_front(ActivationBucket{identity, TokenBucket()});
+        it = activation_index.emplace(identity, activation_buckets.begin()).first;
+    } else {
+        activation_buckets.splice(activation_buckets.begin(), activation_buckets, it->second);
+    }
+    if(it->second->bucket.take(activation, now)) {
+        return true;
+    }
+    refused_activations += 1;
+    return false;
+}
+
+auto Admission::admit_packet(TokenBucket& bucket) -> bool {
+    if(!packet.enabled() || bucket.take(packet, std::chrono::steady_clock::now())) {
+        return true;
+    }
+    refused_packets += 1;
+    return false;
+}
+} // namespace plink
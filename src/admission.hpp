@@ -0,0 +1,60 @@
+#pragma once
+#include <chrono>
+#include <list>
+#include <unordered_map>
+
+#include "sha256.hpp"
+
+namespace plink {
+struct RateLimit {
+    double rate  = 0; // tokens per second, 0 for no limit
+    double burst = 0; // bucket size
+
+    auto enabled() const -> bool {
+        return rate > 0;
+    }
+};
+
+// starts full, refilled continuously
+struct TokenBucket {
+    double                                tokens = 0;
+    std::chrono::steady_clock::time_point last;
+
+    auto refill(const RateLimit& limit, std::chrono::steady_clock::time_point now) -> void;
+    auto take(const RateLimit& limit, std::chrono::steady_clock::time_point now) -> bool;
+};
+
+// token bucket limits checked before any expensive work, so that a refusal costs a few comparisons
+struct Admission {
+    // digest of a user certificate, fixed-size however long the certificate is
+    using Identity = Sha256::Digest;
+
+    struct IdentityHash {
+        // the digest is uniform already
+        auto operator()(const Identity& identity) const -> size_t;
+    };
+
+    struct ActivationBucket {
+        Identity    identity;
+        TokenBucket bucket;
+    };
+
+    RateLimit accept;                     // sessions per second, for the whole server
+    RateLimit activation;                 // activations per second, for each certificate
+    RateLimit packet;                     // control packets per second, for each session
+    size_t    max_identities = 64 * 1024; // certificates tracked at once, the least recently seen is forgotten beyond this
+
+    size_t refused_accepts     = 0;
+    size_t refused_activations = 0;
+    size_t refused_packets     = 0;
+
+    // private
+    TokenBucket                                                                       accept_bucket;
+    std::list<ActivationBucket>                                                       activation_buckets; // most recently used first
+    std::unordered_map<Identity, std::list<ActivationBucket>::iterator, IdentityHash> activation_index;
+
+    auto admit_accept() -> bool;
+    auto admit_activation(const Identity& identity) -> bool;
+    auto admit_packet(TokenBucket& bucket) -> bool;
+};
+} // namespace plink
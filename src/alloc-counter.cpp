@@ -0,0 +1,88 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "alloc-counter.hpp"
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace plink::alloc_counter {
+namespace {
+auto count = std::atomic_size_t(0);
+auto live  = std::atomic_size_t(0);
+
+auto usable_size(void* const ptr) -> size_t {
+#if defined(__GLIBC__)
+    return malloc_usable_size(ptr);
+#else
+    return 0;
+#endif
+}
+
+auto allocate(const size_t size, const size_t align) -> void* {
+    count.fetch_add(1, std::memory_order_relaxed);
+    const auto ptr = align <= __STDCPP_DEFAULT_NEW_ALIGNMENT__ ? std::malloc(size) : std::aligned_alloc(align, (size + align - 1) / align * align);
+    if(ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    live.fetch_add(usable_size(ptr), std::memory_order_relaxed);
+    return ptr;
+}
+
+auto release(void* const ptr) -> void {
+    live.fetch_sub(usable_size(ptr), std::memory_order_relaxed);
+    std::free(ptr);
+}
+} // namespace
+
+auto get() -> size_t {
+    return count.load(std::memory_order_relaxed);
+}
+
+auto bytes() -> size_t {
+    return live.load(std::memory_order_relaxed);
+}
+} // namespace plink::alloc_counter
+
+// nothrow variants fall back to these by default
+auto operator new(const size_t size) -> void* {
+    return plink::alloc_counter::allocate(size, 0);
+}
+
+auto operator new[](const size_t size) -> void* {
+    return plink::alloc_counter::allocate(size, 0);
+}
+
+auto operator new(const size_t size, const std::align_val_t align) -> void* {
+    return plink::alloc_counter::allocate(size, size_t(align));
+}
+
+auto operator new[](const size_t size, const std::align_val_t align) -> void* {
+    return plink::alloc_counter::allocate(size, size_t(align));
+}
+
+auto operator delete(void* const ptr) noexcept -> void {
+    plink::alloc_counter::release(ptr);
+}
+
+auto operator delete[](void* const ptr) noexcept -> void {
+    plink::alloc_counter::release(ptr);
+}
+
+auto operator delete(void* const ptr, size_t /*size*/) noexcept -> void {
+    plink::alloc_counter::release(ptr);
+}
+
+auto operator delete[](void* const ptr, size_t /*size*/) noexcept -> void {
+    plink::alloc_counter::release(ptr);
+}
+
+auto operator delete(void* const ptr, std::align_val_t /*align*/) noexcept -> void {
+    plink::alloc_counter::release(ptr);
+}
+
+auto operator delete[](void* const ptr, std::align_val_t /*align*/) noexcept -> void {
+    plink::alloc_counter::release(ptr);
+}
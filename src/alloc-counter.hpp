@@ -0,0 +1,9 @@
+#pragma once
+#include <cstddef>
+
+// counts every global operator new call when built with -Dalloc_counter=true
+namespace plink::alloc_counter {
+auto get() -> size_t;
+// heap bytes currently held through operator new, 0 if the libc cannot tell allocation sizes
+auto bytes() -> size_t;
+} // namespace plink::alloc_counter
@@ -0,0 +1,120 @@
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "async-log.hpp"
+#include "macros/logger.hpp"
+
+namespace plink::log {
+namespace {
+auto ring    = std::vector<Record>();
+auto mask    = 0uz;
+auto head    = std::atomic_size_t(0);   // next record to write, owned by the writer
+auto tail    = std::atomic_size_t(0);   // next record to fill, owned by the runner
+auto wakeups = std::atomic_uint32_t(0); // bumped on every commit and on stop, the writer sleeps on it
+auto writer  = std::jthread();
+
+auto wake() -> void {
+    wakeups.fetch_add(1, std::memory_order_release);
+    wakeups.notify_one();
+}
+
+auto write(Logger& logger, const Record& record) -> void {
+    const auto text = std::string_view(record.text.data(), record.size);
+    if(record.suppressed != 0) {
+        LOG_INFO(logger, "{} records suppressed", record.suppressed);
+    }
+    switch(record.level) {
+    case Level::Error:
+        LOG_ERROR(logger, "{}", text);
+        break;
+    case Level::Info:
+        LOG_INFO(logger, "{}", text);
+        break;
+    case Level::Debug:
+        LOG_DEBUG(logger, "{}", text);
+        break;
+    }
+}
+
+auto drain(Logger& logger) -> bool {
+    const auto end = tail.load(std::memory_order_acquire);
+    auto       pos = head.load(std::memory_order_relaxed);
+    if(pos == end) {
+        return false;
+    }
+    for(; pos != end; pos += 1) {
+        write(logger, ring[pos & mask]);
+    }
+    head.store(pos, std::memory_order_release);
+    return true;
+}
+} // namespace
+
+Config config;
+
+auto Site::allow() -> bool {
+    if(config.burst == 0) {
+        return true;
+    }
+    const auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    if(now != second) {
+        second = now;
+        count  = 0;
+    }
+    count += 1;
+    if(count <= config.burst || (config.sample != 0 && count % config.sample == 0)) {
+        return true;
+    }
+    suppressed += 1;
+    return false;
+}
+
+auto running() -> bool {
+    return writer.joinable();
+}
+
+auto claim() -> Record* {
+    const auto pos = tail.load(std::memory_order_relaxed);
+    if(pos - head.load(std::memory_order_acquire) > mask) {
+        return nullptr;
+    }
+    return &ring[pos & mask];
+}
+
+auto commit() -> void {
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    wake();
+}
+
+auto start(Logger& logger, const size_t capacity) -> bool {
+    if(running() || capacity == 0) {
+        return false;
+    }
+    ring.resize(std::bit_ceil(capacity));
+    mask   = ring.size() - 1;
+    writer = std::jthread([&logger](const std::stop_token token) {
+        while(!token.stop_requested()) {
+            // read before draining, so a commit after the drain makes the wait return at once
+            const auto seen = wakeups.load(std::memory_order_acquire);
+            if(!drain(logger)) {
+                wakeups.wait(seen, std::memory_order_acquire);
+            }
+        }
+        drain(logger);
+    });
+    return true;
+}
+
+auto stop() -> void {
+    if(!running()) {
+        return;
+    }
+    writer.request_stop();
+    wake();
+    writer.join();
+    writer = std::jthread();
+}
+} // namespace plink::log
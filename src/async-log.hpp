@@ -0,0 +1,90 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <format>
+#include <utility>
+
+#include "util/logger-pre.hpp"
+
+// logging for hot paths, rate-limited per call site and optionally written by a background thread
+// records are formatted into a fixed-size ring on the runner thread, the writer thread passes them to Logger
+namespace plink::log {
+enum class Level : uint8_t {
+    Error,
+    Info,
+    Debug,
+};
+
+struct Config {
+    Level    level  = Level::Debug; // records above this are skipped before formatting
+    uint32_t burst  = 0;            // records per second allowed at each call site, 0 for no limit
+    uint32_t sample = 0;            // after the burst, pass one in this many records, 0 to drop all
+};
+
+struct Site {
+    // private
+    int64_t  second     = 0;
+    uint32_t count      = 0;
+    uint32_t suppressed = 0; // since the last record passed
+
+    auto allow() -> bool;
+};
+
+struct Record {
+    Level                 level;
+    uint16_t              size;
+    uint32_t              suppressed;
+    std::array<char, 248> text; // longer records are truncated
+};
+
+extern Config config;
+
+inline auto enabled(const Level level) -> bool {
+    return level <= config.level;
+}
+
+// the ring has a single producer, so these must be called from the runner thread
+auto running() -> bool;
+auto claim() -> Record*; // nullptr if the ring is full
+auto commit() -> void;
+
+// starts the writer, the ring holds capacity records rounded up to a power of two
+auto start(Logger& logger, size_t capacity) -> bool;
+auto stop() -> void; // writes the remaining records
+
+template <class... Args>
+auto push(Site& site, const Level level, const std::format_string<Args...> format, Args&&... args) -> void {
+    const auto record = claim();
+    if(record == nullptr) {
+        site.suppressed += 1;
+        return;
+    }
+    const auto result  = std::format_to_n(record->text.data(), record->text.size(), format, std::forward<Args>(args)...);
+    record->level      = level;
+    record->size       = uint16_t(std::min(size_t(result.size), record->text.size()));
+    record->suppressed = std::exchange(site.suppressed, 0);
+    commit();
+}
+} // namespace plink::log
+
+// LOG_* compatible macros, each expansion is a call site with its own limit
+#define PLINK_LOG(level, log, logger, ...)                                                         \
+    do {                                                                                           \
+        static auto plink_log_site = ::plink::log::Site();                                         \
+        if(!::plink::log::enabled(::plink::log::Level::level) || !plink_log_site.allow()) {        \
+            break;                                                                                 \
+        }                                                                                          \
+        if(::plink::log::running()) {                                                              \
+            ::plink::log::push(plink_log_site, ::plink::log::Level::level, __VA_ARGS__);           \
+            break;                                                                                 \
+        }                                                                                          \
+        if(const auto suppressed = std::exchange(plink_log_site.suppressed, 0); suppressed != 0) { \
+            log(logger, "{} records suppressed", suppressed);                                      \
+        }                                                                                          \
+        log(logger, __VA_ARGS__);                                                                  \
+    } while(0)
+
+#define PLINK_LOG_ERROR(logger, ...) PLINK_LOG(Error, LOG_ERROR, logger, __VA_ARGS__)
+#define PLINK_LOG_INFO(logger, ...)  PLINK_LOG(Info, LOG_INFO, logger, __VA_ARGS__)
+#define PLINK_LOG_DEBUG(logger, ...) PLINK_LOG(Debug, LOG_DEBUG, logger, __VA_ARGS__)
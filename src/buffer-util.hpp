@@ -0,0 +1,14 @@
+#pragma once
+#include <cstring>
+#include <span>
+
+#include "net/common.hpp"
+
+namespace plink {
+// appends raw bytes to the tail of buffer
+inline auto append_bytes(PrependableBuffer& buffer, const std::span<const std::byte> bytes) -> void {
+    const auto prev = buffer.body().size();
+    buffer.enlarge_forward(bytes.size());
+    std::memcpy(buffer.body().data() + prev, bytes.data(), bytes.size());
+}
+} // namespace plink
@@ -0,0 +1,54 @@
+#include "cert-cache.hpp"
+
+namespace plink {
+auto CertCache::erase(const std::list<Entry>::iterator entry) -> void {
+    index.erase(entry->hash);
+    entries.erase(entry);
+}
+
+auto CertCache::find(const std::string_view hash, const std::string_view content) -> std::optional<bool> {
+    if(capacity == 0) {
+        return std::nullopt;
+    }
+    const auto it = index.find(hash);
+    if(it == index.end()) {
+        misses += 1;
+        return std::nullopt;
+    }
+    const auto entry = it->second;
+    if(std::chrono::steady_clock::now() >= entry->expire) {
+        erase(entry);
+        misses += 1;
+        return std::nullopt;
+    }
+    if(entry->content != content) {
+        // same hash with different content is always forged, leave the entry alone
+        misses += 1;
+        return std::nullopt;
+    }
+    entries.splice(entries.begin(), entries, entry);
+    hits += 1;
+    return entry->ok;
+}
+
+auto CertCache::insert(const std::string_view hash, const std::string_view content, const bool ok, const std::optional<std::chrono::system_clock::time_point> valid_until) -> void {
+    if(capacity == 0) {
+        return;
+    }
+    const auto now    = std::chrono::steady_clock::now();
+    auto       expire = now + ttl;
+    if(valid_until) {
+        const auto left = std::chrono::duration_cast<std::chrono::steady_clock::duration>(*valid_until - std::chrono::system_clock::now());
+        expire          = std::min(expire, now + left);
+    }
+
+    if(const auto it = index.find(hash); it != index.end()) {
+        erase(it->second);
+    }
+    entries.push_front(Entry{std::string(hash), std::string(content), ok, expire});
+    index.emplace(std::string(hash), entries.begin());
+    if(entries.size() > capacity) {
+        erase(std::prev(entries.end()));
+    }
+}
+} // namespace plink
@@ -0,0 +1,33 @@
+#pragma once
+#include <chrono>
+#include <list>
+#include <optional>
+
+#include "util/string-map.hpp"
+
+namespace plink {
+// bounded lru cache of user certificate verification results
+// keyed on the hash part of the certificate, the content is compared on lookup
+struct CertCache {
+    struct Entry {
+        std::string                           hash;
+        std::string                           content;
+        bool                                  ok;
+        std::chrono::steady_clock::time_point expire;
+    };
+
+    size_t               capacity = 1024; // 0 disables the cache
+    std::chrono::seconds ttl      = std::chrono::minutes(10);
+    size_t               hits     = 0;
+    size_t               misses   = 0;
+
+    // private
+    std::list<Entry>                      entries; // most recently used first
+    StringMap<std::list<Entry>::iterator> index;
+
+    auto erase(std::list<Entry>::iterator entry) -> void;
+
+    auto find(std::string_view hash, std::string_view content) -> std::optional<bool>;
+    auto insert(std::string_view hash, std::string_view content, bool ok, std::optional<std::chrono::system_clock::time_point> valid_until) -> void;
+};
+} // namespace plink
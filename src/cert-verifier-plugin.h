@@ -0,0 +1,26 @@
+/* c abi of the in-process user certificate verifier, see --cert-verifier-plugin */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* called once after the plugin is loaded, returns 0 on success */
+int plink_cert_verifier_init(void);
+
+/* returns non-zero if the certificate content is valid
+ * valid_until may be set to a unix time after which the result must not be reused, left untouched otherwise */
+int plink_cert_verifier_verify(const char* content, size_t content_size, int64_t* valid_until);
+
+/* called once before the plugin is unloaded */
+void plink_cert_verifier_shutdown(void);
+
+typedef int (*plink_cert_verifier_init_t)(void);
+typedef int (*plink_cert_verifier_verify_t)(const char* content, size_t content_size, int64_t* valid_until);
+typedef void (*plink_cert_verifier_shutdown_t)(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,438 @@
+#include <charconv>
+#include <csignal>
+#include <limits>
+#include <print>
+
+#include <coop/io.hpp>
+#include <coop/lock-guard.hpp>
+#include <coop/timer.hpp>
+
+#include "cert-verifier.hpp"
+#include "macros/logger.hpp"
+#include "watchdog.hpp"
+
+#define CUTIL_MACROS_PRINT_FUNC(...) LOG_ERROR(logger, __VA_ARGS__)
+#include "macros/coop-unwrap.hpp"
+
+#if defined(_WIN32)
+#include "spawn/process-win.hpp"
+#else
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#endif
+
+namespace plink {
+namespace {
+#if defined(_WIN32)
+constexpr auto poll_interval = std::chrono::milliseconds(5);
+#else
+constexpr auto reap_interval = std::chrono::milliseconds(1); // without pidfd
+#endif
+
+auto parse_valid_until(const std::string_view output) -> std::optional<std::chrono::system_clock::time_point> {
+    constexpr auto key = std::string_view("valid-until=");
+
+    const auto pos = output.find(key);
+    if(pos == output.npos) {
+        return std::nullopt;
+    }
+    auto value = int64_t();
+    if(std::from_chars(output.data() + pos + key.size(), output.data() + output.size(), value).ec != std::errc()) {
+        return std::nullopt;
+    }
+    return std::chrono::system_clock::time_point(std::chrono::seconds(value));
+}
+
+struct SlotGuard {
+    CertVerifier* verifier;
+
+    ~SlotGuard() {
+        verifier->release_slot();
+    }
+};
+
+struct QueueGuard {
+    VerifierWorker* worker;
+
+    ~QueueGuard() {
+        worker->queued -= 1;
+    }
+};
+
+#if !defined(_WIN32)
+struct Child {
+    int pid    = -1;
+    int input  = -1; // stdin if requested, non-blocking
+    int output = -1; // stdout, non-blocking
+};
+
+// starts argv[0] with its stdout, and optionally its stdin, connected to pipes
+auto launch(const char* const* const argv, const bool with_input, Child& child, Logger& logger) -> bool {
+    auto       stdin_pipe  = std::array<int, 2>{-1, -1};
+    auto       stdout_pipe = std::array<int, 2>{-1, -1};
+    const auto close_pipes = [&stdin_pipe, &stdout_pipe] {
+        for(const auto fd : {stdin_pipe[0], stdin_pipe[1], stdout_pipe[0], stdout_pipe[1]}) {
+            if(fd >= 0) {
+                close(fd);
+            }
+        }
+    };
+    if(with_input) {
+        ensure(pipe2(stdin_pipe.data(), O_CLOEXEC) == 0);
+    }
+    if(pipe2(stdout_pipe.data(), O_CLOEXEC) != 0) {
+        close_pipes();
+        bail("failed to create pipe");
+    }
+
+    const auto parent = getpid();
+    child.pid         = fork();
+    if(child.pid < 0) {
+        close_pipes();
+        bail("fork failed");
+    }
+    if(child.pid == 0) {
+#if defined(__linux__)
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if(getppid() != parent) {
+            _exit(1);
+        }
+#endif
+        if(with_input) {
+            dup2(stdin_pipe[0], STDIN_FILENO);
+        }
+        dup2(stdout_pipe[1], STDOUT_FILENO);
+        execv(argv[0], const_cast<char* const*>(argv));
+        _exit(127);
+    }
+    if(with_input) {
+        close(stdin_pipe[0]);
+    }
+    close(stdout_pipe[1]);
+    child.input  = stdin_pipe[1];
+    child.output = stdout_pipe[0];
+    ensure(!with_input || fcntl(child.input, F_SETFL, O_NONBLOCK) == 0);
+    ensure(fcntl(child.output, F_SETFL, O_NONBLOCK) == 0);
+    return true;
+}
+
+// waits for the child to exit without blocking the runner
+auto reap(const int pid, int& status) -> coop::Async<void> {
+#if defined(__linux__)
+    // a pidfd becomes readable when the process exits
+    if(const auto pidfd = int(syscall(SYS_pidfd_open, pid, 0)); pidfd >= 0) {
+        co_await coop::wait_for_file(pidfd, true, false);
+        close(pidfd);
+        waitpid(pid, &status, 0);
+        co_return;
+    }
+#endif
+    while(waitpid(pid, &status, WNOHANG) == 0) {
+        co_await coop::sleep(reap_interval);
+    }
+}
+#endif
+} // namespace
+
+#if !defined(_WIN32)
+auto VerifierWorker::start(const std::string& executable, Logger& logger) -> bool {
+    const auto argv  = std::array<const char*, 3>{executable.data(), "--pool", nullptr};
+    auto       child = Child();
+    ensure(launch(argv.data(), true, child, logger));
+    pid    = child.pid;
+    input  = child.input;
+    output = child.output;
+    return true;
+}
+
+auto VerifierWorker::stop() -> void {
+    if(pid <= 0) {
+        return;
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    close(input);
+    close(output);
+    pid    = -1;
+    input  = -1;
+    output = -1;
+    received.clear();
+}
+
+auto VerifierWorker::read_line(Logger& logger) -> coop::Async<std::optional<std::string>> {
+    auto buf = std::array<char, 256>();
+    while(true) {
+        if(const auto lf = received.find('\n'); lf != received.npos) {
+            auto line = received.substr(0, lf);
+            received.erase(0, lf + 1);
+            co_return line;
+        }
+        const auto len = read(output, buf.data(), buf.size());
+        if(len > 0) {
+            received.append(buf.data(), size_t(len));
+            continue;
+        }
+        coop_ensure(len < 0 && errno == EAGAIN, "verifier worker exited");
+        co_await coop::wait_for_file(output, true, false);
+    }
+}
+
+auto VerifierWorker::write_all(const std::string_view data, Logger& logger) -> coop::Async<bool> {
+    for(auto sent = 0uz; sent < data.size();) {
+        const auto len = write(input, data.data() + sent, data.size() - sent);
+        if(len > 0) {
+            sent += size_t(len);
+            continue;
+        }
+        coop_ensure(len < 0 && errno == EAGAIN, "failed to write to verifier worker");
+        co_await coop::wait_for_file(input, false, true);
+    }
+    co_return true;
+}
+
+auto VerifierWorker::request(const std::string_view content, const std::chrono::steady_clock::time_point deadline, coop::Runner& runner, Logger& logger) -> coop::Async<std::optional<std::string>> {
+    // killing a stuck worker at the deadline fails the write or read waiting on it
+    auto       timed_out = false;
+    const auto watchdog  = Watchdog(runner, deadline, [pid = pid, &timed_out] {
+        timed_out = true;
+        kill(pid, SIGKILL);
+    });
+
+    auto line = std::optional<std::string>();
+    if(co_await write_all(std::format("{}\n{}", content.size(), content), logger)) {
+        line = co_await read_line(logger);
+    }
+    if(!line && timed_out) {
+        LOG_ERROR(logger, "verifier worker timed out");
+    }
+    co_return line;
+}
+#else
+auto VerifierWorker::start(const std::string& /*executable*/, Logger& logger) -> bool {
+    bail("verifier pool is not supported on this platform");
+}
+
+auto VerifierWorker::stop() -> void {
+}
+
+auto VerifierWorker::read_line(Logger& /*logger*/) -> coop::Async<std::optional<std::string>> {
+    co_return std::nullopt;
+}
+
+auto VerifierWorker::write_all(std::string_view /*data*/, Logger& /*logger*/) -> coop::Async<bool> {
+    co_return false;
+}
+
+auto VerifierWorker::request(std::string_view /*content*/, std::chrono::steady_clock::time_point /*deadline*/, coop::Runner& /*runner*/, Logger& /*logger*/) -> coop::Async<std::optional<std::string>> {
+    co_return std::nullopt;
+}
+#endif
+
+VerifierWorker::~VerifierWorker() {
+    stop();
+}
+
+auto CertVerifier::acquire_slot() -> coop::Async<void> {
+    if(running < max_running) {
+        running += 1;
+        co_return;
+    }
+    // release_slot() hands its slot over to us
+    auto event = coop::SingleEvent();
+    waiters.push_back(&event);
+    co_await event;
+}
+
+auto CertVerifier::release_slot() -> void {
+    if(waiters.empty()) {
+        running -= 1;
+        return;
+    }
+    const auto next = waiters.front();
+    waiters.pop_front();
+    next->notify();
+}
+
+#if !defined(_WIN32)
+auto CertVerifier::verify_by_exec(const std::string_view content, Logger& logger) -> coop::Async<std::optional<Verdict>> {
+    co_await acquire_slot();
+    const auto guard = SlotGuard{this};
+
+    auto       cont  = std::string(content);
+    const auto argv  = std::array<const char*, 3>{executable.data(), cont.data(), nullptr};
+    auto       child = Child();
+    coop_ensure(launch(argv.data(), false, child, logger), "failed to launch verifier");
+
+    // killing the verifier at the deadline ends its output, so the reads below need no timeout
+    auto       timed_out = false;
+    const auto watchdog  = Watchdog(*runner, std::chrono::steady_clock::now() + timeout, [pid = child.pid, &timed_out] {
+        timed_out = true;
+        kill(pid, SIGKILL);
+    });
+
+    auto stdout_str = std::string();
+    auto buf        = std::array<char, 256>();
+    while(true) {
+        const auto len = read(child.output, buf.data(), buf.size());
+        if(len > 0) {
+            const auto output = std::string_view(buf.data(), size_t(len));
+            std::print("verifier: {}", output);
+            stdout_str += output;
+            continue;
+        }
+        if(len < 0 && errno == EAGAIN) {
+            co_await coop::wait_for_file(child.output, true, false);
+            continue;
+        }
+        break; // end of output, or an error which ends it as well
+    }
+    close(child.output);
+
+    // the output is closed slightly before the process can be reaped
+    auto status = 0;
+    co_await reap(child.pid, status);
+    coop_ensure(!timed_out, "verifier timed out");
+    coop_ensure(WIFEXITED(status), "verifier exitted abnormally");
+    if(WEXITSTATUS(status) != 0) {
+        LOG_ERROR(logger, "verifier returned non-zero code {}", WEXITSTATUS(status));
+        co_return Verdict{false};
+    }
+
+    co_return Verdict{true, parse_valid_until(stdout_str)};
+}
+#else
+auto CertVerifier::verify_by_exec(const std::string_view content, Logger& logger) -> coop::Async<std::optional<Verdict>> {
+    co_await acquire_slot();
+    const auto guard = SlotGuard{this};
+
+    auto cont = std::string(content);
+    auto args = std::vector<const char*>{executable.data(), cont.data(), nullptr};
+
+    auto stdout_str   = std::string();
+    auto process      = process::Process();
+    auto on_output    = [](const std::span<const char> output) { std::print("verifier: {}", std::string_view(output.data(), output.size())); };
+    process.on_stdout = [&stdout_str, &on_output](const std::span<const char> output) {
+        stdout_str.append(output.data(), output.size());
+        on_output(output);
+    };
+    process.on_stderr = on_output;
+    coop_ensure(process.start({.argv = args, .die_on_parent_exit = true}), "failed to launch verifier");
+
+    // poll the child instead of blocking on it, so that other sessions keep running meanwhile
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while(process.get_status() == process::Status::Running) {
+        process.collect_outputs();
+        if(std::chrono::steady_clock::now() >= deadline) {
+            process.join(true); // force
+            coop_bail("verifier timed out");
+        }
+        co_await coop::sleep(poll_interval);
+    }
+    coop_unwrap(result, process.join());
+    coop_ensure(result.reason == process::Result::ExitReason::Exit, "verifier exitted abnormally");
+    if(result.code != 0) {
+        LOG_ERROR(logger, "verifier returned non-zero code {}", result.code);
+        co_return Verdict{false};
+    }
+
+    co_return Verdict{true, parse_valid_until(stdout_str)};
+}
+#endif
+
+auto CertVerifier::verify_in_pool(const std::string_view content, Logger& logger) -> coop::Async<std::optional<Verdict>> {
+    auto& worker = **std::ranges::min_element(workers, {}, [](const auto& worker) { return worker->queued; });
+    worker.queued += 1;
+    const auto guard = QueueGuard{&worker};
+    const auto lock  = co_await coop::LockGuard::lock(worker.mutex);
+
+    // retry once with a fresh worker if the current one is dead, each attempt gets the full timeout
+    for(auto i = 0; i < 2; i += 1) {
+        if(worker.pid <= 0) {
+            coop_ensure(worker.start(executable, logger), "failed to launch verifier worker");
+        }
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        if(const auto line = co_await worker.request(content, deadline, *runner, logger)) {
+            if(line->starts_with("ok")) {
+                co_return Verdict{true, parse_valid_until(*line)};
+            }
+            LOG_ERROR(logger, "verifier: {}", line->starts_with("ng ") ? line->substr(3) : *line);
+            co_return Verdict{false};
+        }
+        LOG_ERROR(logger, "restarting verifier worker {}", worker.pid);
+        worker.stop();
+    }
+    coop_bail("verifier worker failed");
+}
+
+auto CertVerifier::verify_by_plugin(const std::string_view content) -> Verdict {
+    constexpr auto unset = std::numeric_limits<int64_t>::min();
+
+    auto       valid_until = unset;
+    const auto ok          = plugin_verify(content.data(), content.size(), &valid_until) != 0;
+    if(valid_until == unset) {
+        return Verdict{ok};
+    }
+    return Verdict{ok, std::chrono::system_clock::time_point(std::chrono::seconds(valid_until))};
+}
+
+auto CertVerifier::enabled() const -> bool {
+    return !executable.empty() || plugin != nullptr;
+}
+
+auto CertVerifier::start_pool(const size_t size, Logger& logger) -> bool {
+#if !defined(_WIN32)
+    // writing to a crashed worker must not kill the server
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+    for(auto i = 0uz; i < size; i += 1) {
+        auto& worker = *workers.emplace_back(new VerifierWorker());
+        ensure(worker.start(executable, logger), "failed to launch verifier worker");
+    }
+    return true;
+}
+
+#if !defined(_WIN32)
+auto CertVerifier::load_plugin(const char* const path, Logger& logger) -> bool {
+    plugin = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    ensure(plugin != nullptr, "failed to load verifier plugin: {}", dlerror());
+    const auto init = std::bit_cast<plink_cert_verifier_init_t>(dlsym(plugin, "plink_cert_verifier_init"));
+    plugin_verify   = std::bit_cast<plink_cert_verifier_verify_t>(dlsym(plugin, "plink_cert_verifier_verify"));
+    plugin_shutdown = std::bit_cast<plink_cert_verifier_shutdown_t>(dlsym(plugin, "plink_cert_verifier_shutdown"));
+    ensure(init != nullptr && plugin_verify != nullptr && plugin_shutdown != nullptr, "verifier plugin does not export the required functions");
+    ensure(init() == 0, "verifier plugin initialization failed");
+    return true;
+}
+#else
+auto CertVerifier::load_plugin(const char* const /*path*/, Logger& logger) -> bool {
+    bail("verifier plugin is not supported on this platform");
+}
+#endif
+
+auto CertVerifier::verify(const std::string_view content, Logger& logger) -> coop::Async<std::optional<Verdict>> {
+    if(plugin_verify != nullptr) {
+        co_return verify_by_plugin(content);
+    } else if(!workers.empty()) {
+        co_return co_await verify_in_pool(content, logger);
+    } else {
+        co_return co_await verify_by_exec(content, logger);
+    }
+}
+
+CertVerifier::~CertVerifier() {
+#if !defined(_WIN32)
+    if(plugin != nullptr) {
+        if(plugin_shutdown != nullptr) {
+            plugin_shutdown();
+        }
+        dlclose(plugin);
+    }
+#endif
+}
+} // namespace plink
@@ -0,0 +1,69 @@
+#pragma once
+#include <chrono>
+#include <deque>
+
+#include <coop/generator.hpp>
+#include <coop/mutex.hpp>
+#include <coop/runner-pre.hpp>
+#include <coop/single-event.hpp>
+
+#include "cert-verifier-plugin.h"
+#include "util/logger-pre.hpp"
+
+namespace plink {
+struct Verdict {
+    bool ok;
+    // reported by the verifier with "valid-until=<unix time>"
+    std::optional<std::chrono::system_clock::time_point> valid_until = std::nullopt;
+};
+
+// long-lived verifier process speaking the line protocol
+// request:  "<content length>\n<content>"
+// response: "ok[ valid-until=<unix time>]\n" or "ng <reason>\n"
+struct VerifierWorker {
+    int         pid    = -1;
+    int         input  = -1; // stdin of the worker, non-blocking
+    int         output = -1; // stdout of the worker, non-blocking
+    size_t      queued = 0;  // requests waiting for or holding this worker
+    std::string received;
+    coop::Mutex mutex;
+
+    auto start(const std::string& executable, Logger& logger) -> bool;
+    auto stop() -> void;
+    auto read_line(Logger& logger) -> coop::Async<std::optional<std::string>>;
+    auto write_all(std::string_view data, Logger& logger) -> coop::Async<bool>;
+    auto request(std::string_view content, std::chrono::steady_clock::time_point deadline, coop::Runner& runner, Logger& logger) -> coop::Async<std::optional<std::string>>;
+
+    ~VerifierWorker();
+};
+
+// runs the external user certificate verifier without blocking the runner
+struct CertVerifier {
+    std::string               executable;
+    std::chrono::milliseconds timeout     = std::chrono::seconds(10);
+    size_t                    max_running = 8;
+    coop::Runner*             runner      = nullptr; // runs the timeout watchdogs
+
+    // private
+    size_t                                       running = 0;
+    std::deque<coop::SingleEvent*>               waiters;
+    std::vector<std::unique_ptr<VerifierWorker>> workers;
+    void*                                        plugin          = nullptr;
+    plink_cert_verifier_verify_t                 plugin_verify   = nullptr;
+    plink_cert_verifier_shutdown_t               plugin_shutdown = nullptr;
+
+    auto acquire_slot() -> coop::Async<void>;
+    auto release_slot() -> void;
+    auto verify_by_exec(std::string_view content, Logger& logger) -> coop::Async<std::optional<Verdict>>;
+    auto verify_in_pool(std::string_view content, Logger& logger) -> coop::Async<std::optional<Verdict>>;
+    auto verify_by_plugin(std::string_view content) -> Verdict;
+
+    auto enabled() const -> bool;
+    auto start_pool(size_t size, Logger& logger) -> bool;
+    auto load_plugin(const char* path, Logger& logger) -> bool;
+    // nullopt means the verifier could not give an answer
+    auto verify(std::string_view content, Logger& logger) -> coop::Async<std::optional<Verdict>>;
+
+    ~CertVerifier();
+};
+} // namespace plink
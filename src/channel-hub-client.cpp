@@ -20,6 +20,36 @@ auto ChannelHubClient::get_channels() -> coop::Async<std::optional<std::vector<s
     co_return std::move(channels.channels);
 }
 
+auto ChannelHubClient::query_channels(std::string prefix, std::string cursor, const uint32_t limit) -> coop::Async<std::optional<proto::ChannelsPage>> {
+    coop_unwrap_mut(page, co_await parser.receive_response<proto::ChannelsPage>(proto::QueryChannels{std::move(prefix), std::move(cursor), limit}));
+    co_return std::move(page);
+}
+
+auto ChannelHubClient::subscribe_channels() -> coop::Async<std::optional<std::vector<std::string>>> {
+    overflowed = false;
+    channel_changes.clear();
+    coop_unwrap_mut(channels, co_await parser.receive_response<proto::Channels>(proto::SubscribeChannels()));
+    co_return std::move(channels.channels);
+}
+
+auto ChannelHubClient::unsubscribe_channels() -> coop::Async<bool> {
+    coop_ensure(co_await parser.receive_response<proto::Success>(proto::UnsubscribeChannels()));
+    co_return true;
+}
+
+auto ChannelHubClient::next_channel_change() -> coop::Async<std::optional<ChannelChange>> {
+    if(channel_changes.empty() && !closed && !overflowed) {
+        auto event            = coop::SingleEvent();
+        channel_changes_event = &event;
+        co_await event;
+        channel_changes_event = nullptr;
+    }
+    coop_ensure(!channel_changes.empty());
+    auto change = std::move(channel_changes.front());
+    channel_changes.pop_front();
+    co_return change;
+}
+
 auto ChannelHubClient::request_pad(std::string channel) -> coop::Async<std::optional<std::string>> {
     coop_unwrap_mut(resp, co_await parser.receive_response<proto::PadCreated>(proto::RequestPad{std::move(channel)}));
     coop_ensure(!resp.pad_name.empty());
@@ -28,12 +58,34 @@ auto ChannelHubClient::request_pad(std::string channel) -> coop::Async<std::opti
 
 auto ChannelHubClient::connect(const char* const addr, const uint16_t port, std::string user_certificate) -> coop::Async<bool> {
     // this->backend.reset(backend);
-    backend.on_closed   = [this] { on_closed(); };
+    backend.on_closed = [this] {
+        closed = true;
+        if(channel_changes_event != nullptr) {
+            channel_changes_event->notify();
+        }
+        on_closed();
+    };
     backend.on_received = [this](PrependableBuffer buffer) -> coop::Async<void> {
         co_await parser.callbacks.invoke(std::move(buffer));
     };
-    parser.send_data                                = [this](PrependableBuffer buffer) { return backend.send(std::move(buffer)); };
-    parser.callbacks.by_type[proto::RequestPad::pt] = [this](const net::Header header, PrependableBuffer buffer) -> coop::Async<bool> {
+    parser.send_data                                        = [this](PrependableBuffer buffer) { return backend.send(std::move(buffer)); };
+    parser.callbacks.by_type[proto::ChannelsChanged::pt]    = [this](const net::Header /*header*/, PrependableBuffer buffer) -> coop::Async<bool> {
+        constexpr auto error_value = false;
+        co_unwrap_v_mut(change, (serde::load<net::BinaryFormat, proto::ChannelsChanged>(buffer.body())));
+        channel_changes.push_back({std::move(change.name), change.added});
+        if(channel_changes_event != nullptr) {
+            channel_changes_event->notify();
+        }
+        co_return true;
+    };
+    parser.callbacks.by_type[proto::ChannelsOverflowed::pt] = [this](const net::Header /*header*/, PrependableBuffer /*buffer*/) -> coop::Async<bool> {
+        overflowed = true;
+        if(channel_changes_event != nullptr) {
+            channel_changes_event->notify();
+        }
+        co_return true;
+    };
+    parser.callbacks.by_type[proto::RequestPad::pt]         = [this](const net::Header header, PrependableBuffer buffer) -> coop::Async<bool> {
         constexpr auto error_value = false;
         co_unwrap_v_mut(request, (serde::load<net::BinaryFormat, proto::RequestPad>(buffer.body())));
         auto pad_name = co_await on_pad_request(request.channel_name);
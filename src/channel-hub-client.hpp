@@ -1,14 +1,27 @@
 #pragma once
+#include <deque>
 #include <optional>
 
+#include <coop/single-event.hpp>
+
+#include "channel-hub-protocol.hpp"
 #include "net/enc/client.hpp"
 #include "net/packet-parser.hpp"
 
 namespace plink {
 struct ChannelHubClient {
+    struct ChannelChange {
+        std::string name;
+        bool        added;
+    };
+
     // private
     net::enc::ClientBackendEncAdaptor backend;
     net::PacketParser                 parser;
+    std::deque<ChannelChange>         channel_changes;
+    coop::SingleEvent*                channel_changes_event = nullptr;
+    bool                              overflowed            = false; // unsubscribed by the server, changes were lost
+    bool                              closed                = false;
 
     // callbacks
     std::function<coop::Async<std::optional<std::string>>(std::string_view channel)> on_pad_request = [](std::string_view) -> coop::Async<std::optional<std::string>> { co_return std::nullopt; };
@@ -17,6 +30,13 @@ struct ChannelHubClient {
     auto register_channel(std::string channel) -> coop::Async<bool>;
     auto unregister_channel(std::string channel) -> coop::Async<bool>;
     auto get_channels() -> coop::Async<std::optional<std::vector<std::string>>>;
+    auto query_channels(std::string prefix, std::string cursor = {}, uint32_t limit = 0) -> coop::Async<std::optional<proto::ChannelsPage>>;
+    // returns current channels, following changes are read with next_channel_change()
+    auto subscribe_channels() -> coop::Async<std::optional<std::vector<std::string>>>;
+    auto unsubscribe_channels() -> coop::Async<bool>;
+    // waits for a channel change, nullopt if the connection is closed or the subscription overflowed
+    // after an overflow, subscribe again to get the current channels
+    auto next_channel_change() -> coop::Async<std::optional<ChannelChange>>;
     auto request_pad(std::string channel) -> coop::Async<std::optional<std::string>>;
 
     auto connect(const char* addr, uint16_t port, std::string user_certificate = {}) -> coop::Async<bool>;
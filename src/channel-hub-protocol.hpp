@@ -54,4 +54,50 @@ struct PadCreated {
     std::string SerdeField(pad_name); // empty name indicates error
     SerdeFieldsEnd;
 };
+
+// server <- receiver => (ChannelsPage) query registered channels page by page
+struct QueryChannels {
+    constexpr static auto pt = net::PacketType(0x09);
+
+    SerdeFieldsBegin;
+    std::string SerdeField(prefix); // only channels starting with this
+    std::string SerdeField(cursor); // return channels after this, empty to start from the first
+    uint32_t    SerdeField(limit);  // 0 for no limit
+    SerdeFieldsEnd;
+};
+
+// server -> receiver => () registered channels in name order
+struct ChannelsPage {
+    constexpr static auto pt = net::PacketType(0x0A);
+
+    SerdeFieldsBegin;
+    std::vector<std::string> SerdeField(channels);
+    std::string              SerdeField(next_cursor); // empty if this is the last page
+    SerdeFieldsEnd;
+};
+
+// server <- receiver => (Channels) start receiving ChannelsChanged, current channels are returned
+struct SubscribeChannels {
+    constexpr static auto pt = net::PacketType(0x0B);
+};
+
+// server <- receiver => (Result) stop receiving ChannelsChanged
+struct UnsubscribeChannels {
+    constexpr static auto pt = net::PacketType(0x0C);
+};
+
+// server -> receiver => () a channel was registered or unregistered
+struct ChannelsChanged {
+    constexpr static auto pt = net::PacketType(0x0D);
+
+    SerdeFieldsBegin;
+    std::string SerdeField(name);
+    bool        SerdeField(added);
+    SerdeFieldsEnd;
+};
+
+// server -> receiver => () the receiver fell behind and was unsubscribed, changes were dropped
+struct ChannelsOverflowed {
+    constexpr static auto pt = net::PacketType(0x0E);
+};
 } // namespace plink::proto
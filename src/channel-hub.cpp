@@ -1,7 +1,19 @@
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <iterator>
+#include <list>
+
+#include <coop/lock-guard.hpp>
+#include <coop/runner.hpp>
+
+#include "async-log.hpp"
 #include "channel-hub-protocol.hpp"
 #include "macros/logger.hpp"
+#include "pool.hpp"
 #include "protocol.hpp"
 #include "server.hpp"
+#include "util/string-map.hpp"
 
 #define CUTIL_MACROS_PRINT_FUNC(...) LOG_ERROR(logger, __VA_ARGS__)
 #include "macros/coop-unwrap.hpp"
@@ -34,45 +46,79 @@ const auto estr = std::array{
 
 static_assert(Error::Limit == estr.size());
 
+// a subscriber with this many changes unsent is unsubscribed instead of buffering more
+constexpr auto channel_changes_limit = 1024uz;
+
 struct ChannelHub;
 struct ChannelHubSession;
+struct Channel;
 
 struct PadRequest {
-    ChannelHubSession* requester;
-    net::PacketID      packet_id;
+    ChannelHubSession*               requester = nullptr; // nullptr if the requester has gone
+    net::PacketID                    packet_id = 0;
+    Channel*                         channel   = nullptr; // the channel whose requests hold this
+    std::list<PadRequest*>::iterator index;               // position in requester->requests
+    uint32_t                         count     = 1;       // answers this entry stands for, more than one only for merged canceled requests
 };
 
 struct Channel {
-    std::string             name;
-    ChannelHubSession*      session;
-    std::vector<PadRequest> requests;
-};
-
-struct ChannelHub : Server {
-    std::vector<Channel> channels;
-
-    auto alloc_session() -> coop::Async<Session*> override;
-    auto free_session(Session* ptr) -> coop::Async<void> override;
+    std::string            name;
+    ChannelHubSession*     session;
+    std::deque<PadRequest> requests;    // answered in order by the host, canceled ones are kept to keep the order
+    size_t                 cancels = 0; // requests canceled since the last compaction
 };
 
 struct ChannelHubSession : Session {
-    ChannelHub* server;
+    ChannelHub*                         server;
+    std::vector<Channel*>               channels; // channels hosted by this session
+    std::list<PadRequest*>              requests; // unanswered pad requests sent by this session
+    bool                                subscribed = false;
+    std::vector<proto::ChannelsChanged> changes;                // waiting to be sent to this subscriber
+    bool                                flushing     = false;   // someone is sending changes
+    uint32_t                            pins         = 0;       // writes started outside the registry lock, the session stays alive until they end
+    coop::SingleEvent*                  unpin_waiter = nullptr; // free_session waiting for pins to drop to zero
+
+    auto unpin() -> void;
+    auto on_received(net::Header header, net::BytesRef payload, PrependableBuffer buffer) -> coop::Async<bool> override;
+    auto trim() -> void override;
+};
 
-    auto on_received(PrependableBuffer buffer) -> coop::Async<bool> override;
+// an answer decided under the registry lock and sent after releasing it, the session is pinned meanwhile
+struct PendingError {
+    ChannelHubSession* session;
+    net::PacketID      packet_id;
 };
 
-auto cond(const std::string& name) -> auto {
-    return [&name](Channel& ch) { return ch.name == name; };
-}
+struct ChannelHub : Server {
+    StringMap<Channel>                      channels;
+    std::optional<std::vector<std::string>> names_cache; // sorted, reset on every channel change
+    std::vector<ChannelHubSession*>         subscribers;
+    std::vector<ChannelHubSession*>         overflowed; // unsubscribed by queue_channel_change, pinned until told so
+    Pool<ChannelHubSession, 64>             session_pool;
+
+    ChannelHub();
+
+    auto channel_names() -> const std::vector<std::string>&;
+    auto cancel_request(PadRequest& request) -> void;
+    auto compact_requests(Channel& channel) -> void;
+    // called under the registry lock, the changes are sent by flush_channel_changes() after releasing it
+    auto queue_channel_change(const std::string& name, bool added) -> void;
+    auto flush_channel_changes() -> coop::Async<void>;
+    auto remove_channel(Channel& channel) -> std::vector<PendingError>;
+    auto send_errors(std::vector<PendingError> errors) -> coop::Async<void>;
+    // run with runner->push_task(), so the caller does not wait for writes to other sessions
+    auto notify_sessions(std::vector<PendingError> errors) -> coop::Async<void>;
+    auto handled_packet_types() const -> std::span<const net::PacketType> override;
+    auto trim() -> void override;
+    auto alloc_session() -> coop::Async<Session*> override;
+    auto free_session(Session* ptr) -> coop::Async<void> override;
+};
 
-auto ChannelHubSession::on_received(PrependableBuffer buffer) -> coop::Async<bool> {
+auto ChannelHubSession::on_received(const net::Header header, const net::BytesRef payload, PrependableBuffer buffer) -> coop::Async<bool> {
     auto& logger = server->logger;
 
-    coop_unwrap(parsed, net::split_header(buffer.body()));
-    const auto [header, payload] = parsed;
-
     if(header.type == proto::ActivateSession::pt) {
-        coop_ensure(handle_activation(payload, *server));
+        coop_ensure(co_await handle_activation(payload, *server));
         goto finish;
     } else {
         coop_ensure(activated, "{}", estr[Error::NotActivated]);
@@ -81,65 +127,147 @@ auto ChannelHubSession::on_received(PrependableBuffer buffer) -> coop::Async<boo
     switch(header.type) {
     case proto::RegisterChannel::pt: {
         coop_unwrap(request, (serde::load<net::BinaryFormat, proto::RegisterChannel>(payload)));
-        LOG_INFO(logger, "received channel register request name={}", request.name);
+        PLINK_LOG_INFO(logger, "received channel register request name={}", request.name);
+        {
+            const auto lock = co_await server->lock_registry();
 
-        coop_ensure(!request.name.empty(), "{}", estr[Error::EmptyChannelName]);
-        coop_ensure(std::ranges::find_if(server->channels, cond(request.name)) == server->channels.end(), "{}", estr[Error::ChannelFound]);
+            coop_ensure(!request.name.empty(), "{}", estr[Error::EmptyChannelName]);
+            coop_ensure(server->channels.find(request.name) == server->channels.end(), "{}", estr[Error::ChannelFound]);
 
-        LOG_INFO(logger, "channel {} registerd", request.name);
-        server->channels.push_back(Channel{request.name, this});
+            PLINK_LOG_INFO(logger, "channel {} registerd", request.name);
+            auto& channel = server->channels.insert(std::pair{request.name, Channel{request.name, this}}).first->second;
+            channels.push_back(&channel);
+            server->queue_channel_change(channel.name, true);
+        }
+        const auto sent = co_await parser.send_packet(proto::Success(), header.id);
+        server->runner->push_task(server->notify_sessions({}));
+        coop_ensure(sent);
+        co_return true;
     } break;
     case proto::UnregisterChannel::pt: {
         coop_unwrap(request, (serde::load<net::BinaryFormat, proto::UnregisterChannel>(payload)));
-        LOG_INFO(logger, "received channel unregister request name={}", request.name);
-
-        const auto it = std::ranges::find_if(server->channels, cond(request.name));
-        coop_ensure(it != server->channels.end(), "{}", estr[Error::ChannelNotFound]);
-        auto& channel = *it;
-        coop_ensure(channel.session == this, "{}", estr[Error::SenderMismatch]);
-
-        LOG_INFO(logger, "unregistering channel {}", channel.name);
-        server->channels.erase(it);
+        PLINK_LOG_INFO(logger, "received channel unregister request name={}", request.name);
+        auto errors = std::vector<PendingError>();
+        {
+            const auto lock = co_await server->lock_registry();
+
+            const auto it = server->channels.find(request.name);
+            coop_ensure(it != server->channels.end(), "{}", estr[Error::ChannelNotFound]);
+            auto& channel = it->second;
+            coop_ensure(channel.session == this, "{}", estr[Error::SenderMismatch]);
+
+            PLINK_LOG_INFO(logger, "unregistering channel {}", channel.name);
+            errors = server->remove_channel(channel);
+        }
+        const auto sent = co_await parser.send_packet(proto::Success(), header.id);
+        server->runner->push_task(server->notify_sessions(std::move(errors)));
+        coop_ensure(sent);
+        co_return true;
     } break;
     case proto::GetChannels::pt: {
-        LOG_INFO(logger, "received channel list request");
-        auto payload = std::vector<std::string>();
-        for(auto& channel : server->channels) {
-            payload.push_back(channel.name);
+        PLINK_LOG_INFO(logger, "received channel list request");
+        coop_ensure(co_await parser.send_packet(proto::Channels{server->channel_names()}, header.id));
+        co_return true;
+    } break;
+    case proto::QueryChannels::pt: {
+        coop_unwrap(request, (serde::load<net::BinaryFormat, proto::QueryChannels>(payload)));
+        PLINK_LOG_INFO(logger, "received channel query prefix={} cursor={} limit={}", request.prefix, request.cursor, request.limit);
+
+        const auto& names = server->channel_names();
+        auto        it    = std::ranges::lower_bound(names, request.prefix);
+        if(!request.cursor.empty()) {
+            it = std::max(it, std::ranges::upper_bound(names, request.cursor));
+        }
+        auto page = proto::ChannelsPage();
+        for(; it != names.end() && it->starts_with(request.prefix); it += 1) {
+            if(request.limit != 0 && page.channels.size() == request.limit) {
+                page.next_cursor = page.channels.back();
+                break;
+            }
+            page.channels.push_back(*it);
+        }
+        coop_ensure(co_await parser.send_packet(std::move(page), header.id));
+        co_return true;
+    } break;
+    case proto::SubscribeChannels::pt: {
+        PLINK_LOG_INFO(logger, "received channel subscribe request");
+        // send the snapshot under the lock, so that no change is missed or sent before it
+        const auto lock = co_await server->lock_registry();
+        if(!subscribed) {
+            server->subscribers.push_back(this);
+            subscribed = true;
         }
-        coop_ensure(co_await parser.send_packet(proto::Channels{std::move(payload)}, header.id));
+        coop_ensure(co_await parser.send_packet(proto::Channels{server->channel_names()}, header.id));
         co_return true;
     } break;
+    case proto::UnsubscribeChannels::pt: {
+        PLINK_LOG_INFO(logger, "received channel unsubscribe request");
+        const auto lock = co_await server->lock_registry();
+        if(subscribed) {
+            std::erase(server->subscribers, this);
+            subscribed = false;
+            changes.clear();
+        }
+    } break;
     case proto::RequestPad::pt: {
         coop_unwrap(request, (serde::load<net::BinaryFormat, proto::RequestPad>(payload)));
-        LOG_INFO(logger, "received pad request for channel={}", request.channel_name);
-
-        const auto it = std::ranges::find_if(server->channels, cond(request.channel_name));
-        coop_ensure(it != server->channels.end(), "{}", estr[Error::ChannelNotFound]);
-        auto& channel = *it;
-
-        coop_ensure(co_await channel.session->parser.send_packet(proto::RequestPad{request.channel_name}));
-        channel.requests.push_back({this, header.id});
-        PRINT("name={} size={}", channel.name, channel.requests.size());
+        PLINK_LOG_INFO(logger, "received pad request for channel={}", request.channel_name);
+        auto host = (ChannelHubSession*)(nullptr);
+        {
+            const auto lock = co_await server->lock_registry();
+
+            const auto it = server->channels.find(request.channel_name);
+            coop_ensure(it != server->channels.end(), "{}", estr[Error::ChannelNotFound]);
+            auto& channel = it->second;
+
+            // queued before the host sees it, so that its answer always finds the request
+            auto& pad_request = channel.requests.emplace_back(PadRequest{.requester = this, .packet_id = header.id, .channel = &channel});
+            pad_request.index = requests.insert(requests.end(), &pad_request);
+            host              = channel.session;
+            host->pins += 1;
+            PLINK_LOG_DEBUG(logger, "channel {} has {} pending pad requests", channel.name, channel.requests.size());
+        }
+        const auto sent = co_await host->parser.send_packet(proto::RequestPad{request.channel_name});
+        host->unpin();
+        if(!sent) {
+            // the host is disconnecting, the request is answered with Error when its channels are removed
+            LOG_ERROR(logger, "failed to send pad request for channel {}", request.channel_name);
+        }
         co_return true;
     } break;
     case proto::PadCreated::pt: {
         coop_unwrap(request, (serde::load<net::BinaryFormat, proto::PadCreated>(payload)));
-        LOG_INFO(logger, "received pad request response channel={} name={}", request.channel_name, request.pad_name);
-
-        const auto it = std::ranges::find_if(server->channels, cond(request.channel_name));
-        coop_ensure(it != server->channels.end(), "{}", estr[Error::ChannelNotFound]);
-        auto& channel = *it;
-        coop_ensure(channel.session == this, "{}", estr[Error::SenderMismatch]);
-
-        coop_ensure(!channel.requests.empty(), "{}", estr[Error::RequesterNotFound]);
-        const auto pad_request = channel.requests.front();
-        channel.requests.erase(channel.requests.begin());
+        PLINK_LOG_INFO(logger, "received pad request response channel={} name={}", request.channel_name, request.pad_name);
+        auto pad_request = PadRequest();
+        {
+            const auto lock = co_await server->lock_registry();
+
+            const auto it = server->channels.find(request.channel_name);
+            coop_ensure(it != server->channels.end(), "{}", estr[Error::ChannelNotFound]);
+            auto& channel = it->second;
+            coop_ensure(channel.session == this, "{}", estr[Error::SenderMismatch]);
+
+            coop_ensure(!channel.requests.empty(), "{}", estr[Error::RequesterNotFound]);
+            if(auto& front = channel.requests.front(); front.requester == nullptr) {
+                front.count -= 1;
+                if(front.count == 0) {
+                    channel.requests.pop_front();
+                }
+                PLINK_LOG_INFO(logger, "requester of pad {} has gone", request.pad_name);
+                break;
+            }
+            pad_request = channel.requests.front();
+            channel.requests.pop_front();
+            pad_request.requester->requests.erase(pad_request.index);
+            pad_request.requester->pins += 1;
+        }
 
-        LOG_INFO(logger, "sending pad created name={}", request.pad_name);
+        PLINK_LOG_INFO(logger, "sending pad created name={}", request.pad_name);
         // remove header from buffer so that we can existing storage
         buffer.shrink_backward(sizeof(net::Header));
-        coop_ensure(co_await pad_request.requester->parser.send_packet(proto::PadCreated::pt, std::move(buffer), pad_request.packet_id));
+        const auto sent = co_await pad_request.requester->parser.send_packet(proto::PadCreated::pt, std::move(buffer), pad_request.packet_id);
+        pad_request.requester->unpin();
+        coop_ensure(sent);
     } break;
     default:
         coop_bail("unknown command {}", int(header.type));
@@ -150,8 +278,170 @@ finish:
     co_return true;
 }
 
+auto ChannelHub::channel_names() -> const std::vector<std::string>& {
+    if(!names_cache) {
+        auto& names = names_cache.emplace();
+        names.reserve(channels.size());
+        for(const auto& [name, channel] : channels) {
+            names.push_back(name);
+        }
+        std::ranges::sort(names);
+    }
+    return *names_cache;
+}
+
+// keeps the entry until the host answers it, so that the answers stay in order
+// compacts once more canceled than half the entries piled up, so a cancel costs constant time on average
+auto ChannelHub::cancel_request(PadRequest& request) -> void {
+    auto& channel     = *request.channel;
+    request.requester = nullptr;
+    channel.cancels += 1;
+    if(channel.cancels * 2 > channel.requests.size()) {
+        compact_requests(channel);
+    }
+}
+
+// merges runs of canceled requests into one entry, which keeps the order of answers
+auto ChannelHub::compact_requests(Channel& channel) -> void {
+    channel.cancels = 0;
+    auto requests   = std::deque<PadRequest>();
+    for(const auto& request : channel.requests) {
+        if(request.requester == nullptr && !requests.empty() && requests.back().requester == nullptr) {
+            requests.back().count += request.count;
+            continue;
+        }
+        auto& moved = requests.emplace_back(request);
+        if(moved.requester != nullptr) {
+            *moved.index = &moved;
+        }
+    }
+    channel.requests = std::move(requests); // elements stay where they are
+}
+
+auto ChannelHub::queue_channel_change(const std::string& name, const bool added) -> void {
+    names_cache.reset();
+    std::erase_if(subscribers, [this, &name, added](ChannelHubSession* const session) {
+        if(session->changes.size() < channel_changes_limit) {
+            session->changes.push_back(proto::ChannelsChanged{name, added});
+            return false;
+        }
+        // too far behind, it has to subscribe again for the current channels
+        session->subscribed = false;
+        session->changes.clear();
+        session->pins += 1;
+        overflowed.push_back(session);
+        return true;
+    });
+}
+
+// a slow subscriber delays only the background flush, never the registry or the session which changed it
+auto ChannelHub::flush_channel_changes() -> coop::Async<void> {
+    for(const auto session : std::exchange(overflowed, {})) {
+        if(!session->subscribed) { // not subscribed again meanwhile
+            co_await session->parser.send_packet(proto::ChannelsOverflowed());
+        }
+        session->unpin();
+    }
+    // subscribers can leave while we are writing, so iterate over a snapshot and check each one
+    const auto targets = subscribers;
+    for(const auto target : targets) {
+        if(std::ranges::find(subscribers, target) == subscribers.end() || target->flushing) {
+            continue; // whoever is flushing it sends ours as well, in order
+        }
+        target->flushing = true;
+        target->pins += 1;
+        while(target->subscribed && !target->changes.empty()) {
+            for(auto& change : std::exchange(target->changes, {})) {
+                if(!target->subscribed) {
+                    break;
+                }
+                co_await target->parser.send_packet(std::move(change));
+            }
+        }
+        target->flushing = false;
+        target->unpin(); // target may be freed from here
+    }
+}
+
+// cancels requests to this channel, their errors are to be sent by send_errors()
+auto ChannelHub::remove_channel(Channel& channel) -> std::vector<PendingError> {
+    auto errors = std::vector<PendingError>();
+    for(const auto& request : channel.requests) {
+        if(request.requester == nullptr) {
+            continue;
+        }
+        request.requester->requests.erase(request.index);
+        request.requester->pins += 1;
+        errors.push_back(PendingError{request.requester, request.packet_id});
+    }
+    std::erase(channel.session->channels, &channel);
+    const auto name = std::move(channel.name);
+    channels.erase(channels.find(name));
+    queue_channel_change(name, false);
+    return errors;
+}
+
+auto ChannelHub::send_errors(const std::vector<PendingError> errors) -> coop::Async<void> {
+    for(const auto& error : errors) {
+        co_await error.session->parser.send_packet(proto::Error(), error.packet_id);
+        error.session->unpin();
+    }
+}
+
+auto ChannelHub::notify_sessions(std::vector<PendingError> errors) -> coop::Async<void> {
+    co_await send_errors(std::move(errors));
+    co_await flush_channel_changes();
+}
+
+auto ChannelHubSession::unpin() -> void {
+    pins -= 1;
+    if(pins == 0 && unpin_waiter != nullptr) {
+        std::exchange(unpin_waiter, nullptr)->notify();
+    }
+}
+
+ChannelHub::ChannelHub() {
+    auto& channels_gauge    = metrics.gauge("plink_channels", "registered channels");
+    auto& requests_gauge    = metrics.gauge("plink_pending_pad_requests", "pad requests waiting for the channel owner");
+    auto& subscribers_gauge = metrics.gauge("plink_channel_subscribers", "sessions subscribed to channel changes");
+    metrics.collectors.push_back([this, &channels_gauge, &requests_gauge, &subscribers_gauge] {
+        auto requests = 0uz;
+        for(const auto& [name, channel] : channels) {
+            requests += std::ranges::count_if(channel.requests, [](const PadRequest& request) { return request.requester != nullptr; });
+        }
+        channels_gauge.value    = double(channels.size());
+        requests_gauge.value    = double(requests);
+        subscribers_gauge.value = double(subscribers.size());
+    });
+}
+
+auto ChannelHubSession::trim() -> void {
+    Session::trim();
+    channels.shrink_to_fit();
+}
+
+auto ChannelHub::handled_packet_types() const -> std::span<const net::PacketType> {
+    constexpr static auto types = std::array{
+        proto::RegisterChannel::pt,
+        proto::UnregisterChannel::pt,
+        proto::GetChannels::pt,
+        proto::QueryChannels::pt,
+        proto::SubscribeChannels::pt,
+        proto::UnsubscribeChannels::pt,
+        proto::RequestPad::pt,
+        proto::PadCreated::pt,
+    };
+    return types;
+}
+
+auto ChannelHub::trim() -> void {
+    session_pool.trim();
+    subscribers.shrink_to_fit();
+    shrink_table(channels);
+}
+
 auto ChannelHub::alloc_session() -> coop::Async<Session*> {
-    auto& session  = *(new ChannelHubSession());
+    auto& session  = *session_pool.alloc();
     session.server = this;
     LOG_DEBUG(logger, "session created {}", &session);
     co_return &session;
@@ -159,32 +449,45 @@ auto ChannelHub::alloc_session() -> coop::Async<Session*> {
 
 auto ChannelHub::free_session(Session* const ptr) -> coop::Async<void> {
     auto& session = *std::bit_cast<ChannelHubSession*>(ptr);
-
-    // remove hosting channels
-    for(auto i = channels.begin(); i != channels.end();) {
-        auto& channel = *i;
-        if(channel.session != &session) {
-            // cancel requests from this session
-            for(auto r = channel.requests.end(); r < channel.requests.end();) {
-                r = r->requester == &session ? channel.requests.erase(r) : r + 1;
-            }
-            i += 1;
-            continue;
+    auto  errors  = std::vector<PendingError>();
+    {
+        const auto lock = co_await lock_registry();
+
+        if(session.subscribed) {
+            std::erase(subscribers, &session);
+            session.subscribed = false;
+            session.changes.clear();
+        }
+        // cancel requests from this session, a compaction meanwhile updates the ones left through their index
+        for(const auto request : std::exchange(session.requests, {})) {
+            cancel_request(*request);
         }
-        LOG_INFO(logger, "unregistering channel {}", channel.name);
-        // cancel requests to this session
-        for(const auto& request : channel.requests) {
-            coop_ensure(co_await request.requester->parser.send_packet(proto::Error(), request.packet_id));
+        // remove hosting channels
+        while(!session.channels.empty()) {
+            auto& channel = *session.channels.back();
+            PLINK_LOG_INFO(logger, "unregistering channel {}", channel.name);
+            std::ranges::move(remove_channel(channel), std::back_inserter(errors));
         }
-        i = channels.erase(i);
+    }
+    runner->push_task(notify_sessions(std::move(errors)));
+    if(session.pins > 0) {
+        auto event           = coop::SingleEvent();
+        session.unpin_waiter = &event;
+        co_await event;
     }
 
-    delete &session;
+    co_await session.wait_for_senders();
+    session_pool.free(&session);
     LOG_DEBUG(logger, "session destroyed {}", &session);
 }
 } // namespace
+
+auto create_channel_hub() -> std::unique_ptr<Server> {
+    return std::make_unique<ChannelHub>();
+}
 } // namespace plink
 
+#if !defined(PLINK_NO_MAIN)
 auto main(const int argc, const char* argv[]) -> int {
     using namespace plink;
 
@@ -194,3 +497,4 @@ auto main(const int argc, const char* argv[]) -> int {
     ensure(run(argc, argv, 8081, server, "channel-hub"));
     return 0;
 }
+#endif
@@ -0,0 +1,116 @@
+#include "loopback.hpp"
+
+namespace plink::loopback {
+auto Queue::push(PrependableBuffer buffer) -> bool {
+    if(closed) {
+        return false;
+    }
+    buffers.push_back(std::move(buffer));
+    if(waiter != nullptr) {
+        waiter->notify();
+    }
+    return true;
+}
+
+auto Queue::close() -> void {
+    closed = true;
+    if(waiter != nullptr) {
+        waiter->notify();
+    }
+}
+
+auto Queue::pop() -> coop::Async<std::optional<PrependableBuffer>> {
+    while(buffers.empty() && !closed) {
+        auto event = coop::SingleEvent();
+        waiter     = &event;
+        co_await event;
+        waiter = nullptr;
+    }
+    if(buffers.empty()) {
+        co_return std::nullopt;
+    }
+    auto buffer = std::move(buffers.front());
+    buffers.pop_front();
+    co_return std::move(buffer);
+}
+
+auto ClientBackend::run_server_side() -> coop::Async<void> {
+    // packets of a connection are handled one by one, as the tcp backend does
+    while(auto buffer = co_await to_server.pop()) {
+        co_await server->on_received(client, std::move(*buffer));
+    }
+    server->clients.erase(&client);
+    co_await server->free_client(client.data);
+    to_client.close();
+    task_done();
+}
+
+auto ClientBackend::run_client_side() -> coop::Async<void> {
+    while(auto buffer = co_await to_client.pop()) {
+        co_await on_received(std::move(*buffer));
+    }
+    if(!finishing) {
+        on_closed();
+    }
+    task_done();
+}
+
+auto ClientBackend::task_done() -> void {
+    // the owner may destroy this as soon as the last one is notified
+    running -= 1;
+    if(running == 0 && finishing) {
+        stopped.notify();
+    }
+}
+
+auto ClientBackend::send(PrependableBuffer buffer) -> coop::Async<bool> {
+    co_return to_server.push(std::move(buffer));
+}
+
+auto ClientBackend::finish() -> coop::Async<bool> {
+    finishing = true;
+    to_server.close();
+    if(running > 0) {
+        co_await stopped;
+    }
+    co_return true;
+}
+
+auto ClientBackend::connect(ServerBackend& server) -> coop::Async<bool> {
+    this->server = &server;
+    server.clients.emplace(&client, this);
+    co_await server.alloc_client(client);
+    running = 2;
+    server.runner->push_task(run_server_side());
+    server.runner->push_task(run_client_side());
+    co_return true;
+}
+
+auto ServerBackend::send(const net::ClientData& client, PrependableBuffer buffer) -> coop::Async<bool> {
+    const auto it = clients.find(&client);
+    if(it == clients.end()) {
+        co_return false; // already disconnected
+    }
+    co_return it->second->to_client.push(std::move(buffer));
+}
+
+auto ServerBackend::shutdown() -> coop::Async<bool> {
+    for(const auto& [data, client] : clients) {
+        client->to_server.close();
+    }
+    co_return true;
+}
+
+auto ServerBackend::disconnect(const net::ClientData& client) -> bool {
+    const auto it = clients.find(&client);
+    if(it == clients.end()) {
+        return false;
+    }
+    it->second->to_server.close();
+    return true;
+}
+
+ServerBackend::ServerBackend(coop::Runner& runner)
+    : runner(&runner) {
+}
+} // namespace plink::loopback
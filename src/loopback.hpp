@@ -0,0 +1,64 @@
+#pragma once
+#include <deque>
+#include <unordered_map>
+
+#include <coop/runner.hpp>
+#include <coop/single-event.hpp>
+
+#include "net/backend.hpp"
+
+// in-process transport connecting clients to a server without sockets or encryption
+// each connection is served by two tasks on the runner given to the server backend
+namespace plink::loopback {
+struct Queue {
+    // private
+    std::deque<PrependableBuffer> buffers;
+    coop::SingleEvent*            waiter = nullptr;
+    bool                          closed = false;
+
+    auto push(PrependableBuffer buffer) -> bool;
+    auto close() -> void;
+    // nullopt once closed and drained
+    auto pop() -> coop::Async<std::optional<PrependableBuffer>>;
+};
+
+struct ServerBackend;
+
+struct ClientBackend : net::ClientBackend {
+    // private
+    ServerBackend*    server = nullptr;
+    net::ClientData   client = {}; // the server side of this connection
+    Queue             to_server;
+    Queue             to_client;
+    bool              finishing = false;
+    int               running   = 0; // tasks serving this connection
+    coop::SingleEvent stopped;
+
+    auto run_server_side() -> coop::Async<void>;
+    auto run_client_side() -> coop::Async<void>;
+    auto task_done() -> void;
+
+    // overrides
+    auto send(PrependableBuffer buffer) -> coop::Async<bool> override;
+    auto finish() -> coop::Async<bool> override; // returns after the server freed the session and both tasks exited
+
+    // backend-specific
+    auto connect(ServerBackend& server) -> coop::Async<bool>;
+};
+
+struct ServerBackend : net::ServerBackend {
+    // private
+    coop::Runner*                                              runner;
+    std::unordered_map<const net::ClientData*, ClientBackend*> clients;
+
+    // overrides
+    auto send(const net::ClientData& client, PrependableBuffer buffer) -> coop::Async<bool> override;
+    auto shutdown() -> coop::Async<bool> override;
+
+    // backend-specific
+    // closes one connection after the packets already sent to it, as if the client finished
+    auto disconnect(const net::ClientData& client) -> bool;
+
+    ServerBackend(coop::Runner& runner);
+};
+} // namespace plink::loopback
@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <string_view>
+
+#include <coop/io.hpp>
+#include <coop/timer.hpp>
+
+#include "macros/logger.hpp"
+#include "metrics.hpp"
+#include "watchdog.hpp"
+
+#define CUTIL_MACROS_PRINT_FUNC(...) LOG_ERROR(logger, __VA_ARGS__)
+#include "macros/coop-unwrap.hpp"
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace plink::metrics {
+namespace {
+constexpr auto request_timeout = std::chrono::seconds(1); // for the whole exchange, reading the request and sending the response
+
+template <class T>
+auto sorted_by_name(std::deque<T>& metrics) -> std::vector<T*> {
+    auto result = std::vector<T*>();
+    for(auto& metric : metrics) {
+        result.push_back(&metric);
+    }
+    std::ranges::stable_sort(result, {}, &T::name);
+    return result;
+}
+
+// emits HELP and TYPE once per metric name
+template <class T>
+auto render_family(std::string& out, std::deque<T>& metrics, const std::string_view type, const auto render_one) -> void {
+    auto prev = (const std::string*)(nullptr);
+    for(const auto metric : sorted_by_name(metrics)) {
+        if(prev == nullptr || *prev != metric->name) {
+            std::format_to(std::back_inserter(out), "# HELP {} {}\n# TYPE {} {}\n", metric->name, metric->help, metric->name, type);
+            prev = &metric->name;
+        }
+        render_one(*metric);
+    }
+}
+
+auto join_labels(const std::string_view a, const std::string_view b) -> std::string {
+    if(a.empty() || b.empty()) {
+        return std::format("{}{}", a, b);
+    }
+    return std::format("{},{}", a, b);
+}
+
+auto braced(const std::string_view labels) -> std::string {
+    return labels.empty() ? std::string() : std::format("{{{}}}", labels);
+}
+
+#if !defined(_WIN32)
+struct FD {
+    int fd;
+
+    ~FD() {
+        close(fd);
+    }
+};
+
+auto handle_client(Registry& registry, const int fd, coop::Runner& runner, Logger& logger) -> coop::Async<bool> {
+    // a stalled client is cut off, which wakes the waits below
+    auto       timed_out = false;
+    const auto watchdog  = Watchdog(runner, std::chrono::steady_clock::now() + request_timeout, [fd, &timed_out] {
+        timed_out = true;
+        shutdown(fd, SHUT_RDWR);
+    });
+
+    // the request itself is ignored, anything ending with an empty line gets the metrics
+    auto request = std::string();
+    while(request.find("\r\n\r\n") == request.npos) {
+        auto       buf = std::array<char, 1024>();
+        const auto len = recv(fd, buf.data(), buf.size(), MSG_DONTWAIT);
+        if(len > 0) {
+            request.append(buf.data(), size_t(len));
+            continue;
+        }
+        coop_ensure(!timed_out, "request timed out");
+        coop_ensure(len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK), "connection closed before request ended");
+        co_await coop::wait_for_file(fd, true, false);
+    }
+
+    const auto body     = registry.render();
+    const auto response = std::format("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: {}\r\nConnection: close\r\n\r\n{}", body.size(), body);
+    for(auto sent = 0uz; sent < response.size();) {
+        const auto len = send(fd, response.data() + sent, response.size() - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(len > 0) {
+            sent += size_t(len);
+            continue;
+        }
+        coop_ensure(!timed_out, "response timed out");
+        coop_ensure(len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK), "send failed");
+        co_await coop::wait_for_file(fd, false, true);
+    }
+    co_return true;
+}
+#endif
+} // namespace
+
+auto Histogram::observe(const std::chrono::duration<double> duration) -> void {
+    const auto seconds = duration.count();
+    const auto bucket  = std::ranges::lower_bound(bounds, seconds) - bounds.begin();
+    if(size_t(bucket) < buckets.size()) {
+        buckets[bucket] += 1;
+    }
+    count += 1;
+    sum += seconds;
+}
+
+auto Histogram::observe_since(const std::chrono::steady_clock::time_point start) -> void {
+    observe(std::chrono::steady_clock::now() - start);
+}
+
+auto Registry::counter(std::string name, std::string help, std::string labels) -> Counter& {
+    return counters.emplace_back(Counter{{std::move(name), std::move(help), std::move(labels)}});
+}
+
+auto Registry::gauge(std::string name, std::string help, std::string labels) -> Gauge& {
+    return gauges.emplace_back(Gauge{{std::move(name), std::move(help), std::move(labels)}});
+}
+
+auto Registry::histogram(std::string name, std::string help, std::string labels) -> Histogram& {
+    return histograms.emplace_back(Histogram{{std::move(name), std::move(help), std::move(labels)}});
+}
+
+auto Registry::render() -> std::string {
+    for(const auto& collect : collectors) {
+        collect();
+    }
+
+    auto out = std::string();
+    render_family(out, counters, "counter", [&out](const Counter& counter) {
+        std::format_to(std::back_inserter(out), "{}{} {}\n", counter.name, braced(counter.labels), counter.value);
+    });
+    render_family(out, gauges, "gauge", [&out](const Gauge& gauge) {
+        std::format_to(std::back_inserter(out), "{}{} {}\n", gauge.name, braced(gauge.labels), gauge.value);
+    });
+    render_family(out, histograms, "histogram", [&out](const Histogram& histogram) {
+        auto cumulative = uint64_t(0);
+        for(auto i = 0uz; i < histogram.bounds.size(); i += 1) {
+            cumulative += histogram.buckets[i];
+            const auto labels = join_labels(histogram.labels, std::format("le=\"{}\"", histogram.bounds[i]));
+            std::format_to(std::back_inserter(out), "{}_bucket{} {}\n", histogram.name, braced(labels), cumulative);
+        }
+        const auto labels = join_labels(histogram.labels, "le=\"+Inf\"");
+        std::format_to(std::back_inserter(out), "{}_bucket{} {}\n", histogram.name, braced(labels), histogram.count);
+        std::format_to(std::back_inserter(out), "{}_sum{} {}\n", histogram.name, braced(histogram.labels), histogram.sum);
+        std::format_to(std::back_inserter(out), "{}_count{} {}\n", histogram.name, braced(histogram.labels), histogram.count);
+    });
+    return out;
+}
+
+auto serve(Registry& registry, const uint16_t port, coop::Runner& runner, Logger& logger) -> coop::Async<bool> {
+#if defined(_WIN32)
+    coop_bail("metrics endpoint is not supported on this platform");
+#else
+    const auto listener = FD{socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)};
+    coop_ensure(listener.fd >= 0);
+    const auto reuse = 1;
+    setsockopt(listener.fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    auto addr            = sockaddr_in();
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    coop_ensure(bind(listener.fd, (sockaddr*)&addr, sizeof(addr)) == 0, "failed to bind metrics port {}", port);
+    coop_ensure(listen(listener.fd, 4) == 0);
+    LOG_INFO(logger, "serving metrics on 127.0.0.1:{}", port);
+
+    // scrapes are rare, so serve one client at a time
+    while(true) {
+        const auto fd = accept4(listener.fd, nullptr, nullptr, SOCK_NONBLOCK);
+        if(fd < 0) {
+            const auto error = errno;
+            if(error == EINTR || error == ECONNABORTED) {
+                continue;
+            }
+            if(error == EMFILE || error == ENFILE) {
+                // the pending connection stays readable, so back off instead of spinning on it
+                LOG_ERROR(logger, "metrics accept failed: {}", strerror(error));
+                co_await coop::sleep(std::chrono::seconds(1));
+                continue;
+            }
+            if(error != EAGAIN && error != EWOULDBLOCK) {
+                LOG_ERROR(logger, "metrics accept failed: {}", strerror(error));
+            }
+            co_await coop::wait_for_file(listener.fd, true, false);
+            continue;
+        }
+        const auto client = FD{fd};
+        if(!co_await handle_client(registry, client.fd, runner, logger)) {
+            LOG_DEBUG(logger, "metrics request failed");
+        }
+    }
+#endif
+}
+} // namespace plink::metrics
@@ -0,0 +1,57 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <string>
+
+#include <coop/generator.hpp>
+#include <coop/runner-pre.hpp>
+
+#include "util/logger-pre.hpp"
+
+// counters and histograms exported in prometheus text format
+// everything runs on the single runner thread, so updates are plain increments
+namespace plink::metrics {
+struct Metric {
+    std::string name;
+    std::string help;
+    std::string labels; // e.g. type="3", without braces
+};
+
+struct Counter : Metric {
+    uint64_t value = 0;
+};
+
+struct Gauge : Metric {
+    double value = 0;
+};
+
+struct Histogram : Metric {
+    // upper bounds in seconds
+    constexpr static auto bounds = std::array{0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0};
+
+    std::array<uint64_t, bounds.size()> buckets = {}; // not cumulative
+    uint64_t                            count   = 0;
+    double                              sum     = 0;
+
+    auto observe(std::chrono::duration<double> duration) -> void;
+    auto observe_since(std::chrono::steady_clock::time_point start) -> void;
+};
+
+struct Registry {
+    std::deque<Counter>                counters;
+    std::deque<Gauge>                  gauges;
+    std::deque<Histogram>              histograms;
+    std::vector<std::function<void()>> collectors; // called before rendering to refresh values kept elsewhere
+
+    auto counter(std::string name, std::string help, std::string labels = {}) -> Counter&;
+    auto gauge(std::string name, std::string help, std::string labels = {}) -> Gauge&;
+    auto histogram(std::string name, std::string help, std::string labels = {}) -> Histogram&;
+    auto render() -> std::string;
+};
+
+// serves GET requests on 127.0.0.1:port with the rendered registry, until an error occurs
+// runner runs the timeouts of each request
+auto serve(Registry& registry, uint16_t port, coop::Runner& runner, Logger& logger) -> coop::Async<bool>;
+} // namespace plink::metrics
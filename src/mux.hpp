@@ -0,0 +1,35 @@
+#pragma once
+#include <cstring>
+#include <optional>
+
+#include "buffer-util.hpp"
+#include "peer-linker-protocol.hpp"
+
+namespace plink {
+// packet is a whole packet including its header
+inline auto wrap_mux(const proto::PadHandle handle, const net::BytesRef packet) -> PrependableBuffer {
+    auto buffer = PrependableBuffer();
+    buffer.append_object(net::Header{
+        .type = proto::Mux::pt,
+        .id   = 0,
+        .size = decltype(net::Header::size)(sizeof(handle) + packet.size()),
+    });
+    buffer.append_object(handle);
+    append_bytes(buffer, packet);
+    return buffer;
+}
+
+struct MuxPayload {
+    proto::PadHandle handle;
+    net::BytesRef    packet;
+};
+
+inline auto split_mux(const net::BytesRef payload) -> std::optional<MuxPayload> {
+    auto handle = proto::PadHandle();
+    if(payload.size() < sizeof(handle)) {
+        return std::nullopt;
+    }
+    std::memcpy(&handle, payload.data(), sizeof(handle));
+    return MuxPayload{handle, payload.subspan(sizeof(handle))};
+}
+} // namespace plink
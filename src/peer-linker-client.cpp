@@ -1,10 +1,128 @@
+#include <cstring>
+#include <limits>
+
 #include "peer-linker-client.hpp"
+#include "buffer-util.hpp"
 #include "macros/coop-unwrap.hpp"
+#include "mux.hpp"
 #include "net/tcp/client.hpp"
-#include "peer-linker-protocol.hpp"
 #include "protocol.hpp"
 
 namespace plink {
+namespace {
+using PeerInfo = PeerLinkerClientBackend::Params::PeerInfo;
+
+// feeds each packet of a Batch to handler
+auto unpack_batch(const net::BytesRef batch, const std::function<coop::Async<void>(PrependableBuffer)> handler) -> coop::Async<bool> {
+    constexpr auto error_value = false;
+    for(auto packets = batch; !packets.empty();) {
+        auto header = net::Header();
+        co_ensure_v(packets.size() >= sizeof(header));
+        std::memcpy(&header, packets.data(), sizeof(header));
+        const auto size = sizeof(header) + header.size;
+        co_ensure_v(packets.size() >= size);
+        auto packet = PrependableBuffer();
+        append_bytes(packet, packets.subspan(0, size));
+        co_await handler(std::move(packet));
+        packets = packets.subspan(size);
+    }
+    co_return true;
+}
+
+// Backend is PeerLinkerClientBackend or PeerLinkerMuxPad
+template <class Backend>
+auto setup_pad_callbacks(Backend& backend, const bool group, coop::SingleEvent& linked) -> void {
+    auto& parser = backend.parser;
+
+    parser.callbacks.by_type[proto::Unlinked::pt] = [&backend](net::Header /*header*/, PrependableBuffer /*buffer*/) -> coop::Async<bool> {
+        backend.on_closed();
+        co_return true;
+    };
+    parser.callbacks.by_type[proto::Auth::pt] = [&backend, group, &linked](const net::Header header, PrependableBuffer buffer) -> coop::Async<bool> {
+        constexpr auto error_value = false;
+        co_unwrap_v(request, (serde::load<net::BinaryFormat, proto::Auth>(buffer.body())));
+        const auto ok = backend.on_auth_request(request.requester_name, request.secret);
+        co_ensure_v(co_await backend.parser.send_packet(proto::AuthResponse{request.requester_name, ok}, header.id));
+        if(group) {
+            co_return true; // keep accepting members
+        }
+        linked.notify();
+
+        backend.parser.callbacks.by_type.erase(proto::Auth::pt); // don't need anymore
+        co_return true;
+    };
+    parser.callbacks.by_type[proto::Payload::pt] = [&backend](net::Header /*header*/, PrependableBuffer buffer) -> coop::Async<bool> {
+        co_await backend.on_received(std::move(buffer));
+        co_return true;
+    };
+}
+
+template <class Backend>
+auto start_pad(Backend& backend, const std::string& pad_name, const std::optional<PeerInfo>& peer_info, const bool group, coop::SingleEvent& linked) -> coop::Async<bool> {
+    auto& parser = backend.parser;
+    if(group) {
+        coop_ensure(!peer_info, "group pad cannot link to another pad");
+        coop_ensure(co_await parser.template receive_response<proto::Success>(proto::RegisterGroupPad{pad_name}));
+        backend.on_pad_created();
+        co_return true; // members come later through on_auth_request
+    }
+    coop_ensure(co_await parser.template receive_response<proto::Success>(proto::RegisterPad{pad_name}));
+    backend.on_pad_created();
+    if(peer_info) {
+        coop_ensure(co_await parser.template receive_response<proto::Success>(proto::Link{peer_info->pad_name, peer_info->secret}));
+    } else {
+        co_await linked; // i.e. send auth response
+    }
+    co_return true;
+}
+
+// Connection is PeerLinkerClientBackend or PeerLinkerMux
+template <class Connection>
+auto start_session(Connection& connection, const auto& params) -> coop::Async<bool> {
+    auto& parser = connection.parser;
+
+    connection.peer_linker_addr = params.peer_linker_addr;
+    connection.peer_linker_port = params.peer_linker_port;
+    coop_ensure(co_await connection.inner.connect(new net::tcp::TCPClientBackend(), params.peer_linker_addr, params.peer_linker_port));
+    coop_ensure(co_await parser.template receive_response<proto::Success>(proto::ActivateSession{params.user_certificate}));
+    if(params.accept_batch) {
+        coop_ensure(co_await parser.template receive_response<proto::Success>(proto::EnableBatch()));
+    }
+    if(params.resumable) {
+        coop_unwrap(response, co_await parser.template receive_response<proto::ResumeToken>(proto::GetResumeToken()));
+        connection.resume_token = std::move(response.token);
+    }
+    co_return true;
+}
+
+template <class Connection>
+auto resume_session(Connection& connection) -> coop::Async<bool> {
+    auto& parser = connection.parser;
+
+    coop_ensure(!connection.resume_token.empty(), "session is not resumable");
+    coop_ensure(co_await connection.inner.connect(new net::tcp::TCPClientBackend(), connection.peer_linker_addr.data(), connection.peer_linker_port));
+    // packets buffered by the server arrive before this response
+    coop_unwrap(response, co_await parser.template receive_response<proto::ResumeToken>(proto::Resume{connection.resume_token}));
+    connection.resume_token = std::move(response.token);
+    co_return true;
+}
+
+template <class Backend>
+auto dispatch_packet(Backend& backend, PrependableBuffer buffer) -> coop::Async<void> {
+    coop_unwrap(parsed, net::split_header(buffer.body()));
+    const auto [header, payload] = parsed;
+    if(!co_await backend.parser.callbacks.invoke(header, std::move(buffer))) {
+        auto buf = PrependableBuffer().append_object(
+            net::Header{
+                .type = proto::Error::pt,
+                .id   = header.id,
+                .size = 0,
+            });
+        coop_ensure(co_await backend.send(std::move(buf)));
+    }
+}
+} // namespace
+
 auto PeerLinkerClientBackend::send(PrependableBuffer buffer) -> coop::Async<bool> {
     return parser.send_packet(proto::Payload::pt, std::move(buffer));
 }
@@ -13,21 +131,15 @@ auto PeerLinkerClientBackend::finish() -> coop::Async<bool> {
     return inner.finish();
 }
 
+auto PeerLinkerClientBackend::handle_packet(PrependableBuffer buffer) -> coop::Async<void> {
+    return dispatch_packet(*this, std::move(buffer));
+}
+
 auto PeerLinkerClientBackend::connect(Params params) -> coop::Async<bool> {
     // setup inner backend
     inner.on_closed   = [this] { on_closed(); };
     inner.on_received = [this](PrependableBuffer buffer) -> coop::Async<void> {
-        coop_unwrap(parsed, net::split_header(buffer.body()));
-        const auto [header, payload] = parsed;
-        if(!co_await parser.callbacks.invoke(header, std::move(buffer))) {
-            auto buf = PrependableBuffer().append_object(
-                net::Header{
-                    .type = proto::Error::pt,
-                    .id   = header.id,
-                    .size = 0,
-                });
-            coop_ensure(co_await send(std::move(buf)));
-        }
+        co_await handle_packet(std::move(buffer));
     };
 
     auto linked = coop::SingleEvent();
@@ -36,37 +148,99 @@ auto PeerLinkerClientBackend::connect(Params params) -> coop::Async<bool> {
     // bind parser to backend
     parser.send_data = [this](PrependableBuffer buffer) { return inner.send(std::move(buffer)); };
     // packet type callbacks
-    parser.callbacks.by_type[proto::Unlinked::pt] = [this](net::Header /*header*/, PrependableBuffer /*buffer*/) -> coop::Async<bool> {
+    setup_pad_callbacks(*this, params.group, linked);
+    parser.callbacks.by_type[proto::Batch::pt] = [this](net::Header /*header*/, PrependableBuffer buffer) -> coop::Async<bool> {
+        co_return co_await unpack_batch(buffer.body(), [this](PrependableBuffer packet) { return handle_packet(std::move(packet)); });
+    };
+
+    // start inner backend and negotiation
+    coop_ensure(co_await start_session(*this, params));
+    co_return co_await start_pad(*this, params.pad_name, params.peer_info, params.group, linked);
+}
+
+auto PeerLinkerClientBackend::resume() -> coop::Async<bool> {
+    return resume_session(*this);
+}
+
+auto PeerLinkerMuxPad::handle_packet(PrependableBuffer buffer) -> coop::Async<void> {
+    return dispatch_packet(*this, std::move(buffer));
+}
+
+auto PeerLinkerMuxPad::send(PrependableBuffer buffer) -> coop::Async<bool> {
+    return parser.send_packet(proto::Payload::pt, std::move(buffer));
+}
+
+auto PeerLinkerMuxPad::finish() -> coop::Async<bool> {
+    const auto result = bool(co_await parser.receive_response<proto::Success>(proto::UnregisterPad()));
+    mux->pads.erase(handle);
+    co_return result;
+}
+
+auto PeerLinkerMuxPad::connect(PeerLinkerMux& mux, Params params) -> coop::Async<bool> {
+    coop_ensure(mux.pads.size() <= std::numeric_limits<proto::PadHandle>::max(), "too many pads");
+    while(mux.pads.contains(mux.next_handle)) {
+        mux.next_handle += 1;
+    }
+    this->mux = &mux;
+    handle    = mux.next_handle++;
+    mux.pads.insert({handle, this});
+
+    auto linked = coop::SingleEvent();
+
+    // setup parser
+    // bind parser to the shared connection
+    parser.send_data = [this](PrependableBuffer buffer) { return this->mux->parser.send_data(wrap_mux(handle, buffer.body())); };
+    // packet type callbacks
+    setup_pad_callbacks(*this, params.group, linked);
+
+    co_return co_await start_pad(*this, params.pad_name, params.peer_info, params.group, linked);
+}
+
+auto PeerLinkerMux::handle_packet(PrependableBuffer buffer) -> coop::Async<void> {
+    coop_unwrap(parsed, net::split_header(buffer.body()));
+    const auto [header, payload] = parsed;
+    coop_ensure(co_await parser.callbacks.invoke(header, std::move(buffer)));
+}
+
+auto PeerLinkerMux::connect(Params params) -> coop::Async<bool> {
+    // setup inner backend
+    inner.on_closed = [this] {
+        for(const auto& [handle, pad] : pads) {
+            pad->on_closed();
+        }
         on_closed();
-        co_return true;
     };
-    parser.callbacks.by_type[proto::Auth::pt] = [this, &linked](const net::Header header, PrependableBuffer buffer) -> coop::Async<bool> {
-        constexpr auto error_value = false;
-        co_unwrap_v(request, (serde::load<net::BinaryFormat, proto::Auth>(buffer.body())));
-        const auto ok = on_auth_request(request.requester_name, request.secret);
-        co_ensure_v(co_await parser.send_packet(proto::AuthResponse{request.requester_name, ok}, header.id));
-        linked.notify();
+    inner.on_received = [this](PrependableBuffer buffer) -> coop::Async<void> {
+        co_await handle_packet(std::move(buffer));
+    };
 
-        parser.callbacks.by_type.erase(proto::Auth::pt); // don't need anymore
+    // setup parser
+    // bind parser to backend
+    parser.send_data = [this](PrependableBuffer buffer) { return inner.send(std::move(buffer)); };
+    // packet type callbacks
+    parser.callbacks.by_type[proto::Mux::pt] = [this](net::Header /*header*/, PrependableBuffer buffer) -> coop::Async<bool> {
+        constexpr auto error_value = false;
+        co_unwrap_v(mux, split_mux(buffer.body()));
+        const auto it = pads.find(mux.handle);
+        co_ensure_v(it != pads.end(), "no pad with handle {}", mux.handle);
+        auto packet = PrependableBuffer();
+        append_bytes(packet, mux.packet);
+        co_await it->second->handle_packet(std::move(packet));
         co_return true;
     };
-    parser.callbacks.by_type[proto::Payload::pt] = [this](net::Header /*header*/, PrependableBuffer buffer) -> coop::Async<bool> {
-        co_await on_received(std::move(buffer));
-        co_return true;
+    parser.callbacks.by_type[proto::Batch::pt] = [this](net::Header /*header*/, PrependableBuffer buffer) -> coop::Async<bool> {
+        co_return co_await unpack_batch(buffer.body(), [this](PrependableBuffer packet) { return handle_packet(std::move(packet)); });
     };
 
-    // start inner backend
-    coop_ensure(co_await inner.connect(new net::tcp::TCPClientBackend(), params.peer_linker_addr, params.peer_linker_port));
+    // start inner backend and negotiation
+    co_return co_await start_session(*this, params);
+}
 
-    // start negotiation
-    coop_ensure(co_await parser.receive_response<proto::Success>(proto::ActivateSession{params.user_certificate}));
-    coop_ensure(co_await parser.receive_response<proto::Success>(proto::RegisterPad{params.pad_name}));
-    on_pad_created();
-    if(params.peer_info) {
-        coop_ensure(co_await parser.receive_response<proto::Success>(proto::Link{params.peer_info->pad_name, params.peer_info->secret}));
-    } else {
-        co_await linked; // i.e. send auth response
-    }
-    co_return true;
+auto PeerLinkerMux::resume() -> coop::Async<bool> {
+    return resume_session(*this);
+}
+
+auto PeerLinkerMux::finish() -> coop::Async<bool> {
+    return inner.finish();
 }
 } // namespace plink
@@ -1,16 +1,24 @@
 #pragma once
+#include <unordered_map>
+
 #include <coop/generator.hpp>
 #include <coop/runner-pre.hpp>
 
 #include "net/backend.hpp"
 #include "net/enc/client.hpp"
 #include "net/packet-parser.hpp"
+#include "peer-linker-protocol.hpp"
 
 namespace plink {
 struct PeerLinkerClientBackend : net::ClientBackend {
     // private
     net::enc::ClientBackendEncAdaptor inner;
     net::PacketParser                 parser;
+    std::string                       peer_linker_addr;
+    uint16_t                          peer_linker_port = 0;
+    std::string                       resume_token;
+
+    auto handle_packet(PrependableBuffer buffer) -> coop::Async<void>;
 
     // overrides
     auto send(PrependableBuffer buffer) -> coop::Async<bool> override;
@@ -31,7 +39,67 @@ struct PeerLinkerClientBackend : net::ClientBackend {
         std::string             pad_name;
         std::optional<PeerInfo> peer_info        = {};
         std::string             user_certificate = {};
+        bool                    accept_batch     = false; // let the server merge small packets
+        bool                    group            = false; // accept any number of peers and send payload to all of them
+        bool                    resumable        = false; // allow resume() after the connection is lost
+    };
+    auto connect(Params params) -> coop::Async<bool>;
+    // reconnects and takes over the pad, within the grace period of the server
+    auto resume() -> coop::Async<bool>;
+};
+
+struct PeerLinkerMux;
+
+// a pad sharing the connection of PeerLinkerMux with other pads
+struct PeerLinkerMuxPad : net::ClientBackend {
+    // private
+    PeerLinkerMux*    mux    = nullptr;
+    proto::PadHandle  handle = 0;
+    net::PacketParser parser;
+
+    auto handle_packet(PrependableBuffer buffer) -> coop::Async<void>;
+
+    // overrides
+    auto send(PrependableBuffer buffer) -> coop::Async<bool> override;
+    auto finish() -> coop::Async<bool> override; // unregisters the pad, the connection is kept
+
+    // backend-specific
+    std::function<void()>                                            on_pad_created  = [] {};
+    std::function<bool(std::string_view name, net::BytesRef secret)> on_auth_request = [](std::string_view, net::BytesRef) { return false; };
+
+    struct Params {
+        std::string                                              pad_name;
+        std::optional<PeerLinkerClientBackend::Params::PeerInfo> peer_info = {};
+        bool                                                     group     = false;
+    };
+    auto connect(PeerLinkerMux& mux, Params params) -> coop::Async<bool>;
+};
+
+// one activated session to the server, carrying any number of PeerLinkerMuxPad
+struct PeerLinkerMux {
+    // private
+    net::enc::ClientBackendEncAdaptor                       inner;
+    net::PacketParser                                       parser;
+    std::unordered_map<proto::PadHandle, PeerLinkerMuxPad*> pads;
+    proto::PadHandle                                        next_handle = 0;
+    std::string                                             peer_linker_addr;
+    uint16_t                                                peer_linker_port = 0;
+    std::string                                             resume_token;
+
+    auto handle_packet(PrependableBuffer buffer) -> coop::Async<void>;
+
+    std::function<void()> on_closed = [] {};
+
+    struct Params {
+        const char* peer_linker_addr;
+        uint16_t    peer_linker_port;
+        std::string user_certificate = {};
+        bool        accept_batch     = false;
+        bool        resumable        = false;
     };
     auto connect(Params params) -> coop::Async<bool>;
+    // reconnects and takes over all pads, within the grace period of the server
+    auto resume() -> coop::Async<bool>;
+    auto finish() -> coop::Async<bool>;
 };
 } // namespace plink
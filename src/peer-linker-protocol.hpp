@@ -61,4 +61,49 @@ struct AuthResponse {
 struct Payload {
     constexpr static auto pt = net::PacketType(0x10);
 };
+
+// server <- client => (Result) create pad in server which any number of pads can link to
+// payload from this pad is delivered to all of them, payload from them comes to this pad
+// the layout is the same as RegisterPad
+struct RegisterGroupPad {
+    constexpr static auto pt = net::PacketType(0x12);
+
+    SerdeFieldsBegin;
+    std::string SerdeField(name);
+    SerdeFieldsEnd;
+};
+
+// server <- client => (ResumeToken) ask for a token to resume this session after the connection is lost
+struct GetResumeToken {
+    constexpr static auto pt = net::PacketType(0x13);
+};
+
+// server -> client => () token for Resume, valid until it is used
+struct ResumeToken {
+    constexpr static auto pt = net::PacketType(0x14);
+
+    SerdeFieldsBegin;
+    std::string SerdeField(token);
+    SerdeFieldsEnd;
+};
+
+// server <- client => (ResumeToken) take over the pads of a lost session, instead of ActivateSession
+// packets sent to the pads meanwhile are delivered before the response
+struct Resume {
+    constexpr static auto pt = net::PacketType(0x15);
+
+    SerdeFieldsBegin;
+    std::string SerdeField(token);
+    SerdeFieldsEnd;
+};
+
+using PadHandle = uint16_t;
+
+// server <-> client => () packet of a pad sharing the session with other pads
+// payload is a PadHandle chosen by the client, followed by the whole inner packet with its header
+// RegisterPad, UnregisterPad, Link, Unlink, AuthResponse and Payload are accepted as inner packet,
+// and the server answers with Auth, Unlinked, Payload, Success and Error wrapped with the same handle
+struct Mux {
+    constexpr static auto pt = net::PacketType(0x11);
+};
 } // namespace plink::proto
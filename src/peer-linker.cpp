@@ -1,8 +1,24 @@
+#include <algorithm>
+#include <array>
+#include <format>
+#include <iterator>
+#include <random>
+#include <unordered_map>
+
+#include <coop/lock-guard.hpp>
+#include <coop/runner.hpp>
+
+#include "alloc-counter.hpp"
+#include "async-log.hpp"
 #include "macros/logger.hpp"
+#include "mux.hpp"
 #include "peer-linker-protocol.hpp"
+#include "pool.hpp"
 #include "protocol.hpp"
 #include "server.hpp"
+#include "small-string.hpp"
 #include "util/string-map.hpp"
+#include "watchdog.hpp"
 
 #define CUTIL_MACROS_PRINT_FUNC(...) LOG_ERROR(logger, __VA_ARGS__)
 #include "macros/coop-unwrap.hpp"
@@ -22,6 +38,7 @@ struct Error {
         AuthInProgress,
         AuthNotInProgress,
         AuthorMismatched,
+        GroupPad,
 
         Limit,
     };
@@ -39,157 +56,637 @@ const auto estr = std::array{
     "another authentication in progress",    // AuthInProgress
     "pad not authenticating",                // AuthNotInProgress
     "authenticator mismatched",              // AuthorMismatched
+    "not allowed for group pad",             // GroupPad
 };
 
 static_assert(Error::Limit == estr.size());
 
+// long enough for uuids
+using PadName = SmallString<40>;
+
 struct LinkRequestState {
-    std::string   authenticator_name;
-    net::PacketID packet_id;
+    PadName                               authenticator_name;
+    net::PacketID                         packet_id;
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
 };
 
 struct Pad {
-    std::string                     name;
+    PadName                         name;
+    uint64_t                        id      = 0; // unique for the server's lifetime, unlike the pooled address
     Session*                        session = nullptr;
-    Pad*                            linked  = nullptr;
+    net::PacketParser*              parser  = nullptr; // session's own parser, or the one of its mux slot
+    std::optional<proto::PadHandle> handle;            // set if registered through Mux
+    Pad*                            linked = nullptr;
     std::optional<LinkRequestState> pending_link_request;
+    bool                            group = false;
+    std::vector<Pad*>               members; // pads linked to this group pad
 };
 
-struct PeerLinker : Server {
-    StringMap<Pad> pads;
+// refers to a pad without keeping it alive, resolved again after each suspension
+struct PadRef {
+    PadName  name;
+    uint64_t id = 0;
+};
 
-    auto remove_pad(Pad* pad) -> coop::Async<void>;
-    auto alloc_session() -> coop::Async<Session*> override;
-    auto free_session(Session* ptr) -> coop::Async<void> override;
+struct MuxSlot {
+    net::PacketParser parser; // wraps outgoing packets with the handle
+    Pad*              pad = nullptr;
 };
 
+struct PeerLinker;
+
 struct PeerLinkerSession : Session {
-    PeerLinker* server;
-    Pad*        pad = nullptr;
+    PeerLinker*                                   server;
+    Pad*                                          pad = nullptr; // registered without Mux
+    std::unordered_map<proto::PadHandle, MuxSlot> mux_slots;
+
+    // resumption
+    std::string                    resume_token;
+    std::vector<PrependableBuffer> backlog; // packets sent to the pads while parked, not a deque which allocates even when empty
+    size_t                         backlog_bytes = 0;
+    bool                           parked        = false;   // connection lost, waiting for Resume
+    bool                           overflowed    = false;   // backlog hit the limit, give up resuming
+    bool                           resuming      = false;   // another session is taking over
+    bool                           resumed       = false;
+    bool                           expired       = false;   // grace period ended
+    coop::SingleEvent*             park_waiter   = nullptr; // park_session waiting for one of the above to change
+
+    auto wake_parked() -> void;
+    auto bind_mux_slot(proto::PadHandle handle, MuxSlot& slot) -> void;
+    auto handle_resume(net::Header header, net::BytesRef payload) -> coop::Async<bool>;
+    auto forward_payload(Pad* source, PrependableBuffer buffer) -> coop::Async<bool>;
+    auto broadcast_payload(Pad* source, PrependableBuffer buffer) -> coop::Async<bool>;
+    auto handle_mux(net::BytesRef payload, PrependableBuffer buffer) -> coop::Async<bool>;
+    auto handle_pad_packet(Pad*& pad, net::PacketParser& pad_parser, std::optional<proto::PadHandle> handle, net::Header header, net::BytesRef payload) -> coop::Async<bool>;
+    auto on_received(net::Header header, net::BytesRef payload, PrependableBuffer buffer) -> coop::Async<bool> override;
+    auto trim() -> void override;
+};
 
-    auto on_received(PrependableBuffer buffer) -> coop::Async<bool> override;
+struct PeerLinker : Server {
+    std::unordered_map<std::string_view, Pad*> pads; // keyed by Pad::name
+    Pool<Pad>                                  pad_pool;
+    Pool<PeerLinkerSession, 64>                session_pool;
+    StringMap<PeerLinkerSession*>              resumable; // by resume token
+    size_t                                     relayed_packets  = 0;
+    size_t                                     relayed_bytes    = 0;
+    size_t                                     last_allocations = 0; // allocation count at the last report
+    uint64_t                                   last_pad_id      = 0;
+    metrics::Histogram&                        link_seconds     = metrics.histogram("plink_link_seconds", "time from Link to AuthResponse");
+
+    PeerLinker();
+
+    auto count_relayed_packet(size_t size) -> void;
+    auto is_relay_packet(net::PacketType type) const -> bool override;
+    auto handled_packet_types() const -> std::span<const net::PacketType> override;
+    auto queue_full(const Session* target, size_t size) const -> bool;
+    auto find_pad(const PadRef& ref) const -> Pad*;
+    // called under the registry lock, they return the pads to be told by notify_unlinked() after releasing it
+    auto break_links(Pad* pad) -> std::vector<PadRef>;
+    auto remove_pad(Pad* pad) -> std::vector<PadRef>;
+    auto notify_unlinked(std::vector<PadRef> targets) -> coop::Async<void>;
+    auto unlink_pad(PadRef target) -> coop::Async<void>;
+    auto issue_resume_token(PeerLinkerSession& session) -> void;
+    auto park_session(PeerLinkerSession& session) -> coop::Async<bool>;
+    auto trim() -> void override;
+    auto alloc_session() -> coop::Async<Session*> override;
+    auto free_session(Session* ptr) -> coop::Async<void> override;
 };
 
-auto PeerLinkerSession::on_received(PrependableBuffer buffer) -> coop::Async<bool> {
+// strips the received frame down to the payload in place
+// the receiving pad's parser frames it again, so that the packet id belongs to the receiver's stream
+auto strip_payload_frame(const Pad* const source, PrependableBuffer& buffer) -> void {
+    const auto mux_size = source->handle ? sizeof(net::Header) + sizeof(proto::PadHandle) : 0;
+    buffer.shrink_backward(mux_size + sizeof(net::Header));
+}
+
+auto PeerLinkerSession::forward_payload(Pad* const source, PrependableBuffer buffer) -> coop::Async<bool> {
+    auto& logger = server->logger;
+
+    // no registry lock here; the linked session stays alive until our write is done,
+    // since free_session() waits for its pending writers after unlinking
+    // also, a pad is only registered by an activated session, so activation is not checked again
+    coop_ensure(source != nullptr, "{}", estr[Error::NotRegistered]);
+    if(source->group) {
+        co_return co_await broadcast_payload(source, std::move(buffer));
+    }
+    coop_ensure(source->linked != nullptr, "{}", estr[Error::NotLinked]);
+
+    const auto target     = source->linked->session;
+    const auto size       = buffer.body().size();
+    const auto queue_full = [this, target, size] { return server->queue_full(target, size); };
+    if(queue_full()) {
+        auto& stats = server->queue_stats;
+        switch(server->send_queue_policy) {
+        case QueuePolicy::Pause:
+            stats.paused += 1;
+            do {
+                co_await target->wait_for_space();
+                // the peer may have gone while waiting, do not touch target until checked
+                coop_ensure(source->linked != nullptr && source->linked->session == target, "{}", estr[Error::NotLinked]);
+            } while(queue_full());
+            break;
+        case QueuePolicy::Drop:
+            stats.dropped += 1;
+            LOG_DEBUG(logger, "dropping packet from {} to {}, queue full", source->name, source->linked->name);
+            co_return true;
+        case QueuePolicy::Disconnect:
+            stats.disconnected += 1;
+            PLINK_LOG_INFO(logger, "unlinking {} and {}, queue full", source->name, source->linked->name);
+            co_await server->unlink_pad(PadRef{source->name, source->id});
+            co_return true;
+        }
+    }
+
+    PLINK_LOG_DEBUG(logger, "passthroughing packet from {} to {}", source->name, source->linked->name);
+    server->count_relayed_packet(size);
+    strip_payload_frame(source, buffer);
+    coop_ensure(co_await source->linked->parser->send_packet(proto::Payload::pt, std::move(buffer)));
+    co_return true;
+}
+
+auto PeerLinkerSession::broadcast_payload(Pad* const source, PrependableBuffer buffer) -> coop::Async<bool> {
     auto& logger = server->logger;
+    auto& stats  = server->queue_stats;
+
+    // each session encrypts with its own key, so every member needs its own copy anyway
+    // the received frame is stripped once and handed to the last member as is
+    // pads can leave, and their pooled memory be reused, while we are writing, so iterate over refs and look each one up again
+    const auto group   = PadRef{source->name, source->id};
+    auto       members = std::vector<PadRef>();
+    members.reserve(source->members.size());
+    for(const auto member : source->members) {
+        members.push_back(PadRef{member->name, member->id});
+    }
+    const auto size = buffer.body().size();
+    strip_payload_frame(source, buffer);
+    for(auto i = 0uz; i < members.size(); i += 1) {
+        if(server->find_pad(group) != source) {
+            break;
+        }
+        const auto member = server->find_pad(members[i]);
+        if(member == nullptr || member->linked != source) {
+            continue;
+        }
+        const auto target = member->session;
+        // a slow member must not stall the others, so pausing is treated as dropping here
+        if(server->queue_full(target, size)) {
+            if(server->send_queue_policy == QueuePolicy::Disconnect) {
+                stats.disconnected += 1;
+                PLINK_LOG_INFO(logger, "unlinking {} from group {}, queue full", member->name, group.name);
+                co_await server->unlink_pad(members[i]);
+            } else {
+                stats.dropped += 1;
+                LOG_DEBUG(logger, "dropping packet from group {} to {}, queue full", group.name, member->name);
+            }
+            continue;
+        }
 
-    coop_unwrap(parsed, net::split_header(buffer.body()));
-    const auto [header, payload] = parsed;
+        auto copy = PrependableBuffer();
+        if(i + 1 == members.size()) {
+            copy = std::move(buffer);
+        } else {
+            append_bytes(copy, buffer.body());
+        }
+        server->count_relayed_packet(size);
+        if(!co_await member->parser->send_packet(proto::Payload::pt, std::move(copy))) {
+            LOG_ERROR(logger, "failed to send packet from group {} to {}", group.name, members[i].name);
+        }
+    }
+    co_return true;
+}
+
+auto PeerLinkerSession::on_received(const net::Header header, const net::BytesRef payload, PrependableBuffer buffer) -> coop::Async<bool> {
+    auto& logger = server->logger;
+
+    // relay traffic bypasses the generic dispatch below
+    if(header.type == proto::Payload::pt) {
+        co_return co_await forward_payload(pad, std::move(buffer));
+    }
+    if(header.type == proto::Mux::pt) {
+        co_return co_await handle_mux(payload, std::move(buffer));
+    }
 
     if(header.type == proto::ActivateSession::pt) {
-        coop_ensure(handle_activation(payload, *server));
-        goto finish;
-    } else {
-        coop_ensure(activated, "{}", estr[Error::NotActivated]);
+        coop_ensure(co_await handle_activation(payload, *server));
+        coop_ensure(co_await parser.send_packet(proto::Success(), header.id));
+        co_return true;
+    }
+    if(header.type == proto::Resume::pt) {
+        co_return co_await handle_resume(header, payload);
+    }
+    coop_ensure(activated, "{}", estr[Error::NotActivated]);
+    if(header.type == proto::GetResumeToken::pt) {
+        coop_ensure(server->resume_grace.count() > 0, "resumption disabled");
+        {
+            const auto lock = co_await server->lock_registry();
+            server->issue_resume_token(*this);
+        }
+        coop_ensure(co_await parser.send_packet(proto::ResumeToken{resume_token}, header.id));
+        co_return true;
+    }
+    co_return co_await handle_pad_packet(pad, parser, std::nullopt, header, payload);
+}
+
+auto PeerLinkerSession::bind_mux_slot(const proto::PadHandle handle, MuxSlot& slot) -> void {
+    slot.parser.send_data = [this, handle](PrependableBuffer buffer) { return parser.send_data(wrap_mux(handle, buffer.body())); };
+}
+
+auto PeerLinkerSession::wake_parked() -> void {
+    if(park_waiter != nullptr) {
+        std::exchange(park_waiter, nullptr)->notify();
+    }
+}
+
+auto PeerLinkerSession::handle_resume(const net::Header header, const net::BytesRef payload) -> coop::Async<bool> {
+    auto& logger = server->logger;
+
+    coop_unwrap(request, (serde::load<net::BinaryFormat, proto::Resume>(payload)));
+    PLINK_LOG_INFO(logger, "received resume request");
+    auto lost = (PeerLinkerSession*)(nullptr); // kept alive by park_session while resuming is set
+    {
+        const auto lock = co_await server->lock_registry();
+
+        coop_ensure(!activated, "session already activated");
+        const auto it = server->resumable.find(request.token);
+        coop_ensure(it != server->resumable.end(), "invalid resume token");
+        lost = it->second;
+        coop_ensure(lost->parked && !lost->overflowed && !lost->resuming, "session is not resumable");
+        lost->resuming = true;
+    }
+    // a resume missing packets must not look successful, so give the lost session up instead
+    const auto give_up = [lost] {
+        lost->overflowed = true;
+        lost->resuming   = false;
+        lost->wake_parked();
+    };
+
+    while(true) {
+        // replay the backlog without the lock, packets arriving meanwhile are appended to it for the next round
+        for(auto& buffer : std::exchange(lost->backlog, {})) {
+            lost->backlog_bytes -= buffer.body().size();
+            if(!co_await parser.send_data(std::move(buffer))) {
+                give_up();
+                coop_bail("failed to replay backlog");
+            }
+        }
+        const auto lock = co_await server->lock_registry();
+        if(lost->overflowed) {
+            give_up();
+            coop_bail("backlog overflowed, packets were lost");
+        }
+        if(!lost->backlog.empty()) {
+            continue;
+        }
+
+        // then move the pads over without suspending, so that no packet overtakes the backlog
+        activated = true;
+        batch     = lost->batch;
+        pad       = std::exchange(lost->pad, nullptr);
+        if(pad != nullptr) {
+            pad->session = this;
+            pad->parser  = &parser;
+        }
+        mux_slots = std::exchange(lost->mux_slots, {}); // nodes are moved, so pad->parser stays valid
+        for(auto& [handle, slot] : mux_slots) {
+            bind_mux_slot(handle, slot);
+            slot.pad->session = this;
+        }
+        server->resumable.erase(request.token);
+        lost->resumed = true;
+        lost->wake_parked();
+        server->issue_resume_token(*this);
+        break;
+    }
+    PLINK_LOG_INFO(logger, "session resumed");
+
+    coop_ensure(co_await parser.send_packet(proto::ResumeToken{resume_token}, header.id));
+    co_return true;
+}
+
+auto PeerLinkerSession::handle_mux(const net::BytesRef payload, PrependableBuffer buffer) -> coop::Async<bool> {
+    auto& logger = server->logger;
+
+    coop_ensure(activated, "{}", estr[Error::NotActivated]);
+    coop_unwrap(mux, split_mux(payload));
+    coop_unwrap(parsed, net::split_header(mux.packet));
+    const auto [header, inner] = parsed;
+
+    if(header.type == proto::Payload::pt) {
+        const auto it = mux_slots.find(mux.handle);
+        co_return co_await forward_payload(it != mux_slots.end() ? it->second.pad : nullptr, std::move(buffer));
     }
 
+    auto& slot = mux_slots[mux.handle];
+    if(!slot.parser.send_data) {
+        bind_mux_slot(mux.handle, slot);
+    }
+    if(!co_await handle_pad_packet(slot.pad, slot.parser, mux.handle, header, inner) && header.type != proto::Error::pt) {
+        co_await slot.parser.send_packet(proto::Error(), header.id);
+    }
+    // nothing refers to the slot parser unless a pad is registered on it
+    if(slot.pad == nullptr) {
+        mux_slots.erase(mux.handle);
+    }
+    co_return true;
+}
+
+auto PeerLinkerSession::handle_pad_packet(Pad*& pad, net::PacketParser& pad_parser, const std::optional<proto::PadHandle> handle, const net::Header header, const net::BytesRef payload) -> coop::Async<bool> {
+    auto& logger = server->logger;
+
     switch(header.type) {
-    case proto::RegisterPad::pt: {
+    case proto::RegisterPad::pt:
+    case proto::RegisterGroupPad::pt: {
         coop_unwrap(request, (serde::load<net::BinaryFormat, proto::RegisterPad>(payload)));
-        LOG_INFO(logger, "received pad register request name={}", request.name);
+        PLINK_LOG_INFO(logger, "received pad register request name={}", request.name);
+        const auto lock = co_await server->lock_registry();
 
         coop_ensure(!request.name.empty(), "{}", estr[Error::EmptyPadName]);
         coop_ensure(pad == nullptr, "{}", estr[Error::AlreadyRegistered]);
         coop_ensure(server->pads.find(request.name) == server->pads.end(), "{}", estr[Error::PadFound]);
 
-        LOG_INFO(logger, "pad {} registerd", request.name);
-        pad = &server->pads.insert(std::pair{request.name, Pad{.name = request.name, .session = this}}).first->second;
+        const auto group = header.type == proto::RegisterGroupPad::pt;
+        PLINK_LOG_INFO(logger, "pad {} registerd group={}", request.name, group);
+        pad = server->pad_pool.alloc(Pad{.name = PadName(request.name), .id = server->last_pad_id += 1, .session = this, .parser = &pad_parser, .handle = handle, .group = group});
+        server->pads.emplace(pad->name.view(), pad);
     } break;
     case proto::UnregisterPad::pt: {
-        LOG_INFO(logger, "received unregister request");
+        PLINK_LOG_INFO(logger, "received unregister request");
+        auto unlinked = std::vector<PadRef>();
+        {
+            const auto lock = co_await server->lock_registry();
 
-        coop_ensure(pad != nullptr, "{}", estr[Error::NotRegistered]);
+            coop_ensure(pad != nullptr, "{}", estr[Error::NotRegistered]);
 
-        LOG_INFO(logger, "unregistering pad {}", pad->name);
-        co_await server->remove_pad(pad);
-        pad = nullptr;
+            PLINK_LOG_INFO(logger, "unregistering pad {}", pad->name);
+            unlinked = server->remove_pad(pad);
+            pad      = nullptr;
+        }
+        co_await server->notify_unlinked(std::move(unlinked));
     } break;
     case proto::Link::pt: {
         coop_unwrap(request, (serde::load<net::BinaryFormat, proto::Link>(payload)));
-        LOG_INFO(logger, "received pad link request to {}", request.requestee_name);
-
-        coop_ensure(pad != nullptr, "{}", estr[Error::NotRegistered]);
-        coop_ensure(pad->linked == nullptr, "{}", estr[Error::AlreadyLinked]);
-        coop_ensure(!pad->pending_link_request, "{}", estr[Error::AuthInProgress]);
-        const auto it = server->pads.find(request.requestee_name);
-        coop_ensure(it != server->pads.end(), "{}", estr[Error::PadNotFound]);
-        auto& requestee = it->second;
-
-        LOG_INFO(logger, "sending auth request from {} to {}", pad->name, request.requestee_name);
-        coop_ensure(co_await requestee.session->parser.send_packet(proto::Auth{pad->name, request.secret}));
-        pad->pending_link_request = LinkRequestState{requestee.name, header.id};
+        PLINK_LOG_INFO(logger, "received pad link request to {}", request.requestee_name);
+        auto requestee = PadRef();
+        {
+            const auto lock = co_await server->lock_registry();
+
+            coop_ensure(pad != nullptr, "{}", estr[Error::NotRegistered]);
+            coop_ensure(!pad->group, "{}", estr[Error::GroupPad]);
+            coop_ensure(pad->linked == nullptr, "{}", estr[Error::AlreadyLinked]);
+            coop_ensure(!pad->pending_link_request, "{}", estr[Error::AuthInProgress]);
+            const auto it = server->pads.find(request.requestee_name);
+            coop_ensure(it != server->pads.end(), "{}", estr[Error::PadNotFound]);
+            requestee                 = PadRef{it->second->name, it->second->id};
+            pad->pending_link_request = LinkRequestState{requestee.name, header.id};
+        }
+
+        PLINK_LOG_INFO(logger, "sending auth request from {} to {}", pad->name, requestee.name);
+        // the requestee may have left since the lock was released
+        const auto target = server->find_pad(requestee);
+        if(target == nullptr || !co_await target->parser->send_packet(proto::Auth{std::string(pad->name.view()), request.secret})) {
+            pad->pending_link_request.reset();
+            coop_bail("failed to send auth request to {}", requestee.name);
+        }
         co_return true; // result is sent after auth_response
     } break;
     case proto::Unlink::pt: {
-        LOG_INFO(logger, "received unlink request");
+        PLINK_LOG_INFO(logger, "received unlink request");
+        auto unlinked = std::vector<PadRef>();
+        {
+            const auto lock = co_await server->lock_registry();
 
-        coop_ensure(pad != nullptr, "{}", estr[Error::NotRegistered]);
-        coop_ensure(pad->linked != nullptr, "{}", estr[Error::NotLinked]);
+            coop_ensure(pad != nullptr, "{}", estr[Error::NotRegistered]);
+            coop_ensure(pad->linked != nullptr || !pad->members.empty(), "{}", estr[Error::NotLinked]);
 
-        LOG_INFO(logger, "unlinking pad {} and {}", pad->name, pad->linked->name);
-        coop_ensure(co_await pad->linked->session->parser.send_packet(proto::Unlinked()));
-        pad->linked->linked = nullptr;
-        pad->linked         = nullptr;
+            PLINK_LOG_INFO(logger, "unlinking pad {}", pad->name);
+            unlinked = server->break_links(pad);
+        }
+        co_await server->notify_unlinked(std::move(unlinked));
     } break;
     case proto::AuthResponse::pt: {
         coop_unwrap(request, (serde::load<net::BinaryFormat, proto::AuthResponse>(payload)));
-        LOG_INFO(logger, "received link auth to name={} ok={}", request.requester_name, request.ok);
-
-        coop_ensure(pad != nullptr, "{}", estr[Error::NotRegistered]);
-
-        const auto it = server->pads.find(request.requester_name);
-        coop_ensure(it != server->pads.end(), "{}", estr[Error::PadNotFound]);
-        auto& requester = it->second;
-        coop_ensure(requester.pending_link_request, "{}", estr[Error::AuthNotInProgress]);
-        coop_ensure(pad->name == requester.pending_link_request->authenticator_name, "{}", estr[Error::AuthorMismatched]);
-
-        coop_ensure(co_await requester.session->parser.send_packet(proto::Success(), requester.pending_link_request->packet_id));
-        requester.pending_link_request.reset();
-        if(request.ok) {
-            LOG_INFO(logger, "linking {} and {}", pad->name, requester.name);
-            pad->linked      = &requester;
-            requester.linked = pad;
+        PLINK_LOG_INFO(logger, "received link auth to name={} ok={}", request.requester_name, request.ok);
+        auto requester = PadRef();
+        auto packet_id = net::PacketID();
+        {
+            const auto lock = co_await server->lock_registry();
+
+            coop_ensure(pad != nullptr, "{}", estr[Error::NotRegistered]);
+
+            const auto it = server->pads.find(request.requester_name);
+            coop_ensure(it != server->pads.end(), "{}", estr[Error::PadNotFound]);
+            auto& found = *it->second;
+            coop_ensure(found.pending_link_request, "{}", estr[Error::AuthNotInProgress]);
+            coop_ensure(pad->name == found.pending_link_request->authenticator_name, "{}", estr[Error::AuthorMismatched]);
+
+            server->link_seconds.observe_since(found.pending_link_request->started);
+            requester = PadRef{found.name, found.id};
+            packet_id = found.pending_link_request->packet_id;
+            found.pending_link_request.reset();
+            if(request.ok) {
+                PLINK_LOG_INFO(logger, "linking {} and {}", pad->name, found.name);
+                found.linked = pad;
+                if(pad->group) {
+                    pad->members.push_back(&found);
+                } else {
+                    pad->linked = &found;
+                }
+            }
+        }
+        // a requester which left meanwhile had its links broken by free_session()
+        if(const auto target = server->find_pad(requester); target != nullptr && !co_await target->parser->send_packet(proto::Success(), packet_id)) {
+            LOG_ERROR(logger, "failed to send link result to {}", requester.name);
         }
         co_return true;
     } break;
-    case proto::Payload::pt: {
-        coop_ensure(pad != nullptr, "{}", estr[Error::NotRegistered]);
-        coop_ensure(pad->linked != nullptr, "{}", estr[Error::NotLinked]);
-
-        LOG_DEBUG(logger, "passthroughing packet from {} to {}", pad->name, pad->linked->name);
-        if(0) {
-            PRINT("packet type={} id={} size={}", header.type, header.id, header.size);
-            auto& ih = *(net::Header*)(payload.data());
-            PRINT("inner type={} id={} size={}", ih.type, ih.id, ih.size);
-            // dump_hex(payload);
-        }
-        // remove header from buffer so that we can existing storage
-        buffer.shrink_backward(sizeof(net::Header));
-        coop_ensure(co_await pad->linked->session->parser.send_packet(proto::Payload::pt, std::move(buffer)));
-        co_return true;
-    }
     default:
         coop_bail("unknown packet type {}", header.type);
     }
 
-finish:
-    coop_ensure(co_await parser.send_packet(proto::Success(), header.id));
+    coop_ensure(co_await pad_parser.send_packet(proto::Success(), header.id));
     co_return true;
 }
 
-auto PeerLinker::remove_pad(Pad* const pad) -> coop::Async<void> {
+PeerLinker::PeerLinker() {
+    auto& pads_gauge      = metrics.gauge("plink_pads", "registered pads");
+    auto& links_gauge     = metrics.gauge("plink_links", "linked pairs, or members of group pads");
+    auto& resumable_gauge = metrics.gauge("plink_resumable_sessions", "sessions holding a resume token");
+    auto& packets_total   = metrics.counter("plink_relayed_packets_total", "payload packets relayed");
+    auto& bytes_total     = metrics.counter("plink_relayed_bytes_total", "payload bytes relayed");
+    auto& pool_gauge      = metrics.gauge("plink_pool_bytes", "bytes held by the session and pad slabs");
+    metrics.collectors.push_back([this, &pads_gauge, &links_gauge, &resumable_gauge, &packets_total, &bytes_total, &pool_gauge] {
+        auto links = 0uz;
+        for(const auto& [name, pad] : pads) {
+            // count each pair once, from the side that is not a group
+            links += pad->linked != nullptr && (pad->linked->group || pad < pad->linked) ? 1 : 0;
+        }
+        pads_gauge.value      = double(pads.size());
+        links_gauge.value     = double(links);
+        resumable_gauge.value = double(resumable.size());
+        packets_total.value   = relayed_packets;
+        bytes_total.value     = relayed_bytes;
+        pool_gauge.value      = double(session_pool.bytes() + pad_pool.bytes());
+    });
+}
+
+auto PeerLinker::is_relay_packet(const net::PacketType type) const -> bool {
+    return type == proto::Payload::pt || type == proto::Mux::pt;
+}
+
+auto PeerLinker::handled_packet_types() const -> std::span<const net::PacketType> {
+    constexpr static auto types = std::array{
+        proto::RegisterPad::pt,
+        proto::RegisterGroupPad::pt,
+        proto::UnregisterPad::pt,
+        proto::Link::pt,
+        proto::Unlink::pt,
+        proto::AuthResponse::pt,
+        proto::GetResumeToken::pt,
+        proto::Resume::pt,
+    };
+    return types;
+}
+
+auto PeerLinker::count_relayed_packet(const size_t size) -> void {
+    relayed_packets += 1;
+    relayed_bytes += size;
+#if defined(PLINK_ALLOC_COUNTER)
+    constexpr auto report_interval = 1uz << 16;
+    if(relayed_packets % report_interval == 0) {
+        const auto allocations = alloc_counter::get();
+        LOG_INFO(logger, "relayed {} packets, {:.2f} allocations per packet", relayed_packets, double(allocations - last_allocations) / report_interval);
+        last_allocations = allocations;
+    }
+#endif
+}
+
+auto PeerLinker::queue_full(const Session* const target, const size_t size) const -> bool {
+    // a packet larger than the limit is let through once the queue is empty
+    return send_queue_limit != 0 && target->queued_bytes > 0 && target->queued_bytes + size > send_queue_limit;
+}
+
+auto PeerLinker::find_pad(const PadRef& ref) const -> Pad* {
+    const auto it = pads.find(ref.name.view());
+    return it != pads.end() && it->second->id == ref.id ? it->second : nullptr;
+}
+
+// detaches pad from its peers and returns them, but not pad itself
+// a group pad is not told when one of its members leaves
+auto PeerLinker::break_links(Pad* const pad) -> std::vector<PadRef> {
+    auto unlinked = std::vector<PadRef>();
+    for(const auto member : std::exchange(pad->members, {})) {
+        member->linked = nullptr;
+        unlinked.push_back(PadRef{member->name, member->id});
+    }
+    if(pad->linked == nullptr) {
+        return unlinked;
+    }
+    const auto peer = std::exchange(pad->linked, nullptr);
+    if(peer->group) {
+        std::erase(peer->members, pad);
+    } else {
+        peer->linked = nullptr;
+        unlinked.push_back(PadRef{peer->name, peer->id});
+    }
+    return unlinked;
+}
+
+auto PeerLinker::remove_pad(Pad* const pad) -> std::vector<PadRef> {
     if(pad == nullptr) {
-        co_return;
+        return {};
+    }
+    auto unlinked = break_links(pad);
+    pads.erase(pad->name.view()); // the key refers to the name, so erase it first
+    pad_pool.free(pad);
+    return unlinked;
+}
+
+// without the registry lock, so each pad is looked up again right before its write
+auto PeerLinker::notify_unlinked(const std::vector<PadRef> targets) -> coop::Async<void> {
+    for(const auto& target : targets) {
+        // skip pads which left or were linked again meanwhile
+        if(const auto pad = find_pad(target); pad != nullptr && pad->linked == nullptr) {
+            co_await pad->parser->send_packet(proto::Unlinked());
+        }
+    }
+}
+
+// called from the relay path, which must not wait for the slow peer, so the notices are sent by their own task
+auto PeerLinker::unlink_pad(const PadRef target) -> coop::Async<void> {
+    auto unlinked = std::vector<PadRef>();
+    {
+        const auto lock = co_await lock_registry();
+        const auto pad  = find_pad(target);
+        if(pad == nullptr || pad->linked == nullptr) {
+            co_return; // already unlinked while waiting for the lock
+        }
+        unlinked = break_links(pad);
+        unlinked.push_back(target);
+    }
+    runner->push_task(notify_unlinked(std::move(unlinked)));
+}
+
+auto PeerLinker::issue_resume_token(PeerLinkerSession& session) -> void {
+    auto device = std::random_device();
+    auto token  = std::string();
+    for(auto i = 0; i < 4; i += 1) {
+        token += std::format("{:08x}{:08x}", device(), device());
     }
-    if(pad->linked != nullptr) {
-        co_await pad->linked->session->parser.send_packet(proto::Unlinked());
-        pad->linked->linked = nullptr;
+    if(!session.resume_token.empty()) {
+        resumable.erase(session.resume_token);
     }
-    pads.erase(pad->name);
+    session.resume_token = token;
+    resumable.insert(std::pair{token, &session});
+}
+
+// keeps the pads of a lost session registered, buffering packets sent to them,
+// until another session resumes it or the grace period ends
+// returns true if resumed
+auto PeerLinker::park_session(PeerLinkerSession& session) -> coop::Async<bool> {
+    session.parked           = true;
+    session.parser.send_data = [this, &session](PrependableBuffer buffer) -> coop::Async<bool> {
+        const auto size = buffer.body().size();
+        if(session.backlog_bytes + size > resume_backlog_limit) {
+            session.overflowed = true;
+            session.wake_parked();
+            co_return false;
+        }
+        session.backlog_bytes += size;
+        session.backlog.push_back(std::move(buffer));
+        co_return true;
+    };
+
+    const auto watchdog = Watchdog(*runner, std::chrono::steady_clock::now() + resume_grace, [&session] {
+        session.expired = true;
+        session.wake_parked();
+    });
+    while(!session.resumed && (session.resuming || (!session.overflowed && !session.expired))) {
+        auto event          = coop::SingleEvent();
+        session.park_waiter = &event;
+        co_await event;
+    }
+    const auto lock = co_await lock_registry();
+    if(!session.resumed) {
+        // a Resume may have taken the lock first, so check again
+        resumable.erase(session.resume_token);
+    }
+    co_return session.resumed;
+}
+
+auto PeerLinkerSession::trim() -> void {
+    Session::trim();
+    shrink_table(mux_slots);
+}
+
+auto PeerLinker::trim() -> void {
+    pad_pool.trim();
+    session_pool.trim();
+    shrink_table(pads);
+    shrink_table(resumable);
 }
 
 auto PeerLinker::alloc_session() -> coop::Async<Session*> {
-    auto& session  = *(new PeerLinkerSession());
+    auto& session  = *session_pool.alloc();
     session.server = this;
     LOG_DEBUG(logger, "session created {}", &session);
     co_return &session;
@@ -197,13 +694,32 @@ auto PeerLinker::alloc_session() -> coop::Async<Session*> {
 
 auto PeerLinker::free_session(Session* const ptr) -> coop::Async<void> {
     auto& session = *std::bit_cast<PeerLinkerSession*>(ptr);
-    co_await remove_pad(session.pad);
-    delete &session;
+    if(resume_grace.count() > 0 && !session.resume_token.empty() && co_await park_session(session)) {
+        LOG_DEBUG(logger, "session {} taken over", &session);
+    } else {
+        auto unlinked = std::vector<PadRef>();
+        {
+            const auto lock = co_await lock_registry();
+            unlinked        = remove_pad(session.pad);
+            for(auto& [handle, slot] : session.mux_slots) {
+                std::ranges::move(remove_pad(slot.pad), std::back_inserter(unlinked));
+            }
+            resumable.erase(session.resume_token);
+        }
+        co_await notify_unlinked(std::move(unlinked));
+    }
+    co_await session.wait_for_senders();
+    session_pool.free(&session);
     LOG_DEBUG(logger, "session destroyed {}", &session);
 }
 } // namespace
+
+auto create_peer_linker() -> std::unique_ptr<Server> {
+    return std::make_unique<PeerLinker>();
+}
 } // namespace plink
 
+#if !defined(PLINK_NO_MAIN)
 auto main(const int argc, const char* argv[]) -> int {
     using namespace plink;
 
@@ -213,3 +729,4 @@ auto main(const int argc, const char* argv[]) -> int {
     ensure(run(argc, argv, 8080, server, "peer-linker"));
     return 0;
 }
+#endif
@@ -0,0 +1,84 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace plink {
+// slab allocator for objects of one type
+// slots are carved from chunks of chunk_size and recycled through a free list, chunks are kept until trim()
+// objects must be freed before the pool is destroyed
+template <class T, size_t chunk_size = 256>
+struct Pool {
+    // private
+    union Slot {
+        Slot*                next;
+        alignas(T) std::byte storage[sizeof(T)];
+    };
+    std::vector<std::unique_ptr<Slot[]>> chunks;
+    Slot*                                free_slots = nullptr;
+    size_t                               used       = 0;
+
+    template <class... Args>
+    auto alloc(Args&&... args) -> T* {
+        if(free_slots == nullptr) {
+            auto& chunk = chunks.emplace_back(new Slot[chunk_size]);
+            for(auto i = chunk_size; i > 0; i -= 1) {
+                chunk[i - 1].next = std::exchange(free_slots, &chunk[i - 1]);
+            }
+        }
+        const auto slot = std::exchange(free_slots, free_slots->next);
+        used += 1;
+        return new(slot->storage) T(std::forward<Args>(args)...);
+    }
+
+    auto free(T* const ptr) -> void {
+        ptr->~T();
+        const auto slot = std::launder(reinterpret_cast<Slot*>(ptr));
+        slot->next      = std::exchange(free_slots, slot);
+        used -= 1;
+    }
+
+    // releases chunks without any object in use
+    auto trim() -> void {
+        if(chunks.size() * chunk_size - used < chunk_size) {
+            return; // too few free slots to fill a chunk, skip the walk
+        }
+        // chunk index of each free slot, found by address
+        auto bases = std::vector<std::pair<const Slot*, size_t>>();
+        for(auto i = 0uz; i < chunks.size(); i += 1) {
+            bases.emplace_back(chunks[i].get(), i);
+        }
+        std::ranges::sort(bases);
+        const auto chunk_of = [&bases](const Slot* const slot) {
+            return std::prev(std::ranges::upper_bound(bases, std::pair{slot, std::numeric_limits<size_t>::max()}))->second;
+        };
+        auto free_counts = std::vector<size_t>(chunks.size());
+        for(auto slot = free_slots; slot != nullptr; slot = slot->next) {
+            free_counts[chunk_of(slot)] += 1;
+        }
+
+        // drop the slots of empty chunks from the free list, then the chunks themselves
+        auto slots = std::exchange(free_slots, nullptr);
+        while(slots != nullptr) {
+            const auto slot = std::exchange(slots, slots->next);
+            if(free_counts[chunk_of(slot)] != chunk_size) {
+                slot->next = std::exchange(free_slots, slot);
+            }
+        }
+        for(auto i = chunks.size(); i > 0; i -= 1) {
+            if(free_counts[i - 1] == chunk_size) {
+                chunks.erase(chunks.begin() + ptrdiff_t(i - 1));
+            }
+        }
+    }
+
+    // bytes held by the chunks, used or not
+    auto bytes() const -> size_t {
+        return chunks.size() * chunk_size * sizeof(Slot);
+    }
+};
+} // namespace plink
@@ -20,4 +20,24 @@ struct ActivateSession {
     std::string SerdeField(user_certificate);
     SerdeFieldsEnd;
 };
+
+// server <- client => (Success) let server merge packets to this client into Batch
+struct EnableBatch {
+    constexpr static auto pt = net::PacketType(0xf0);
+};
+
+// server -> client => () concatenated packets, each with its own header
+struct Batch {
+    constexpr static auto pt = net::PacketType(0xf1);
+};
+
+// bounds of a Batch, larger packets are written on their own instead of being copied
+constexpr auto batch_packet_limit = size_t(1024);      // bytes of a packet to be merged, including its header
+constexpr auto batch_size_limit   = size_t(64 * 1024); // bytes of the packets in one Batch
+constexpr auto batch_count_limit  = size_t(256);       // packets in one Batch
+
+// server <- client => (Result) write the trace ring to a file on the server, if built with tracing
+struct DumpTrace {
+    constexpr static auto pt = net::PacketType(0xf2);
+};
 } // namespace plink::proto
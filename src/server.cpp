@@ -1,86 +1,449 @@
+#include <array>
 #include <cstdint>
 #include <filesystem>
+#include <format>
+#include <limits>
 #include <optional>
+#include <span>
 #include <string_view>
 
 #include <coop/lock-guard.hpp>
+#include <coop/timer.hpp>
 
+#include "async-log.hpp"
+#include "buffer-util.hpp"
 #include "macros/logger.hpp"
 #include "net/enc/server.hpp"
 #include "net/tcp/server.hpp"
 #include "protocol.hpp"
 #include "server.hpp"
+#include "sha256.hpp"
 #include "util/argument-parser.hpp"
 #include "util/file-io.hpp"
 
 #define CUTIL_MACROS_PRINT_FUNC(...) LOG_ERROR(logger, __VA_ARGS__)
 #include "macros/coop-unwrap.hpp"
 
-#if defined(_WIN32)
-#include "spawn/process-win.hpp"
-#else
-#include "spawn/process.hpp"
-#endif
-
 namespace plink {
 namespace {
-auto verify_user_cert(Server& server, const std::string_view cert) -> bool {
+auto admit_activation(Server& server, const std::string_view cert) -> bool {
+    if(!server.admission.activation.enabled()) {
+        return true; // skip hashing as well
+    }
+    const auto identity = Sha256().update(std::as_bytes(std::span(cert))).finish();
+    return server.admission.admit_activation(identity);
+}
+
+// nullopt if no verdict could be given for now, e.g. refused by the rate limit or the verifier failed
+auto verify_user_cert(Server& server, const std::string_view cert) -> coop::Async<std::optional<bool>> {
     auto& logger = server.logger;
 
     auto& key = server.session_key;
     if(!key) {
-        return true;
+        coop_ensure(admit_activation(server, cert), "activation refused by rate limit");
+        co_return true;
+    }
+    const auto parsed = key->split_user_certificate_to_hash_and_content(cert);
+    if(!parsed) {
+        LOG_ERROR(logger, "malformed user certificate");
+        co_return false;
     }
-    unwrap(parsed, key->split_user_certificate_to_hash_and_content(cert));
-    const auto [hash_str, content] = parsed;
-    ensure(key->verify_user_certificate_hash(hash_str, content));
+    const auto [hash_str, content] = *parsed;
 
-    auto& verifier = server.user_cert_verifier;
-    if(verifier.empty()) {
-        return true;
+    // an exact match means the hash was checked before, so skip it too
+    auto&      cache  = server.cert_cache;
+    const auto cached = cache.find(hash_str, content);
+    if(!cached && !key->verify_user_certificate_hash(hash_str, content)) {
+        LOG_ERROR(logger, "user certificate hash mismatched");
+        co_return false;
+    }
+    // only signed certificates get a bucket, so forged ones cannot evict the real ones
+    coop_ensure(admit_activation(server, cert), "activation refused by rate limit");
+    if(cached) {
+        LOG_DEBUG(logger, "certificate cache hit, hits={} misses={}", cache.hits, cache.misses);
+        co_return *cached;
     }
-    auto cont = std::string(content);
-    auto args = std::vector<const char*>{verifier.data(), cont.data(), nullptr};
 
-    auto process      = process::Process();
-    auto on_output    = [](const std::span<const char> output) { std::print("verifier: {}", std::string_view(output.data(), output.size())); };
-    process.on_stdout = on_output;
-    process.on_stderr = on_output;
-    ensure(process.start({.argv = args, .die_on_parent_exit = true}), "failed to launch verifier");
-    while(process.get_status() == process::Status::Running) {
-        process.collect_outputs();
+    auto verdict = Verdict{true};
+    if(server.cert_verifier.enabled()) {
+        const auto start = std::chrono::steady_clock::now();
+        coop_unwrap_mut(result, co_await server.cert_verifier.verify(content, logger));
+        server.verifier_seconds.observe_since(start);
+        verdict = result;
     }
-    unwrap(result, process.join());
-    ensure(result.reason == process::Result::ExitReason::Exit, "verifier exitted abnormally");
-    ensure(result.code == 0, "verifier returned non-zero code {}", result.code);
+    cache.insert(hash_str, content, verdict.ok, verdict.valid_until);
 
-    return true;
+    co_return verdict.ok;
+}
+
+// after its one Error, or left open and ignored if the backend cannot close a single connection
+auto close_refused(Server& server, const Session& session) -> void {
+    if(server.close_client) {
+        server.close_client(*session.client);
+    }
+}
+
+auto finish_write(Server& server, Session& session, const size_t size) -> void {
+    session.queued_bytes -= size;
+    server.queue_stats.queued_bytes -= size;
+    session.wake_space_waiters();
+}
+
+auto build_batch(const std::span<PrependableBuffer> packets, const size_t size) -> PrependableBuffer {
+    static_assert(proto::batch_size_limit <= std::numeric_limits<decltype(net::Header::size)>::max());
+    auto batch = PrependableBuffer();
+    batch.append_object(net::Header{
+        .type = proto::Batch::pt,
+        .id   = 0,
+        .size = decltype(net::Header::size)(size),
+    });
+    for(auto& packet : packets) {
+        append_bytes(batch, packet.body());
+    }
+    return batch;
 }
 
+// counts the leading packets which fit in one Batch, 0 if the first one is too large to be merged
+auto batchable_prefix(const std::span<PrependableBuffer> packets, size_t& size) -> size_t {
+    auto count = size_t(0);
+    size       = 0;
+    for(const auto& packet : packets) {
+        const auto packet_size = packet.body().size();
+        if(packet_size > proto::batch_packet_limit || count == proto::batch_count_limit || size + packet_size > proto::batch_size_limit) {
+            break;
+        }
+        count += 1;
+        size += packet_size;
+    }
+    return count;
+}
+
+// the first sender becomes the writer and flushes everything queued meanwhile,
+// so that a burst of small packets leaves as one write
+auto send_batched(Server& server, const net::ClientData& client, Session& session, PrependableBuffer buffer) -> coop::Async<bool> {
+    session.batched.push_back(std::move(buffer));
+    if(session.batch_writing) {
+        co_return true;
+    }
+    session.batch_writing = true;
+
+    const auto lock   = co_await session.lock_send();
+    auto       result = true;
+    while(!session.batched.empty()) {
+        // wait for followers only while packets are flowing, an idle link sends at once
+        const auto now = std::chrono::steady_clock::now();
+        if(session.batched.size() == 1 && server.batch_delay.count() > 0 && now - session.last_write < server.batch_delay) {
+            co_await coop::sleep(server.batch_delay);
+        }
+        // packets queued while writing are appended to session.batched, so the order is kept
+        std::swap(session.batched, session.writing);
+        for(auto rest = std::span(session.writing); !rest.empty();) {
+            auto       size  = size_t(0);
+            const auto count = batchable_prefix(rest, size);
+            auto       data  = PrependableBuffer();
+            if(count <= 1) {
+                size = rest[0].body().size();
+                data = std::move(rest[0]);
+                rest = rest.subspan(1);
+            } else {
+                data = build_batch(rest.first(count), size);
+                rest = rest.subspan(count);
+            }
+            PLINK_TRACE_SCOPE(Send, proto::Batch::pt, &session);
+            result &= co_await server.backend->send(client, std::move(data));
+            session.last_write = std::chrono::steady_clock::now();
+            finish_write(server, session, size);
+        }
+        session.writing.clear();
+    }
+    session.batch_writing = false;
+    co_return result;
+}
+
+auto sweep_idle(Server& server) -> coop::Async<void> {
+    auto& logger = server.logger;
+    while(true) {
+        co_await coop::sleep(server.idle_trim);
+        const auto trimmed = co_await server.trim_idle();
+        LOG_DEBUG(logger, "trimmed {} idle sessions", trimmed);
+    }
+}
 } // namespace
-auto Session::handle_activation(const net::BytesRef payload, Server& server) -> bool {
+
+auto Session::handle_activation(const net::BytesRef payload, Server& server) -> coop::Async<bool> {
     auto& logger = server.logger;
 
-    unwrap(request, (serde::load<net::BinaryFormat, proto::ActivateSession>(payload)));
+    coop_unwrap(request, (serde::load<net::BinaryFormat, proto::ActivateSession>(payload)));
 
-    LOG_INFO(logger, "received activate session");
-    ensure(verify_user_cert(server, request.user_certificate), "failed to verify user certificate");
+    PLINK_LOG_INFO(logger, "received activate session");
+    const auto start = std::chrono::steady_clock::now();
+    const auto verdict = co_await verify_user_cert(server, request.user_certificate);
+    coop_ensure(verdict, "could not verify user certificate, may be retried");
+    if(!*verdict) {
+        // the caller answers this one and closes the session
+        refused      = true;
+        refusal_sent = true;
+        coop_bail("user certificate rejected");
+    }
+    server.activation_seconds.observe_since(start);
     activated = true;
-    LOG_INFO(logger, "session activated");
+    PLINK_LOG_INFO(logger, "session activated");
 
-    return true;
+    co_return true;
+}
+
+auto Session::wait_for_senders() -> coop::Async<void> {
+    // the caller must have made this session unreachable beforehand,
+    // so no one can enqueue a new write after the current ones
+    const auto lock = co_await coop::LockGuard::lock(send_mutex);
+}
+
+auto Session::wait_for_space() -> coop::Async<void> {
+    // woken by the write in progress, which must exist since queued_bytes > 0
+    auto event = coop::SingleEvent();
+    space_waiters.push_back(&event);
+    co_await event;
+}
+
+auto Session::wake_space_waiters() -> void {
+    for(const auto event : std::exchange(space_waiters, {})) {
+        event->notify();
+    }
+}
+
+#if defined(PLINK_TRACE)
+auto Session::lock_send() -> coop::Async<coop::LockGuard> {
+    PLINK_TRACE_SCOPE(SendWait, 0, this);
+    co_return co_await coop::LockGuard::lock(send_mutex);
+}
+
+auto Server::lock_registry() -> coop::Async<coop::LockGuard> {
+    PLINK_TRACE_SCOPE(RegistryWait, 0, nullptr);
+    co_return co_await coop::LockGuard::lock(mutex);
+}
+#endif
+
+auto Session::trim() -> void {
+    // both are empty while nothing is queued, but keep the capacity of the last burst
+    batched.shrink_to_fit();
+    writing.shrink_to_fit();
+}
+
+auto Server::link_session(Session* const session) -> void {
+    session->next = std::exchange(session_list, session);
+    if(session->next != nullptr) {
+        session->next->prev = session;
+    }
+}
+
+auto Server::unlink_session(Session* const session) -> void {
+    if(sweep_cursor == session) {
+        sweep_cursor = session->next;
+    }
+    (session->prev != nullptr ? session->prev->next : session_list) = session->next;
+    if(session->next != nullptr) {
+        session->next->prev = session->prev;
+    }
+}
+
+auto Server::trim_idle() -> coop::Async<size_t> {
+    constexpr auto chunk_size = 1024uz;
+
+    // sessions connecting meanwhile are linked in front of the cursor, and left for the next sweep
+    auto trimmed = 0uz;
+    sweep_cursor = session_list;
+    while(sweep_cursor != nullptr) {
+        for(auto i = 0uz; i < chunk_size && sweep_cursor != nullptr; i += 1) {
+            const auto session = std::exchange(sweep_cursor, sweep_cursor->next);
+            if(std::exchange(session->active, false) || session->queued_bytes > 0) {
+                continue;
+            }
+            session->trim();
+            trimmed += 1;
+        }
+        if(sweep_cursor != nullptr) {
+            co_await coop::sleep(std::chrono::milliseconds(1));
+        }
+    }
+    // no malloc_trim() here, it walks the whole heap on the runner
+    // empty pool chunks are returned by trim(), the rest is reused by malloc for the next sessions
+    trim();
+    co_return trimmed;
+}
+
+auto Server::create_packet_metrics() -> void {
+    constexpr auto common_types = std::array{proto::Error::pt, proto::ActivateSession::pt, proto::EnableBatch::pt, proto::DumpTrace::pt};
+    const auto     create       = [this](const net::PacketType type) {
+        auto& histogram = packet_seconds[type];
+        if(histogram == nullptr) {
+            histogram = &metrics.histogram("plink_packet_seconds", "time to process a packet by type", std::format("type=\"{}\"", int(type)));
+        }
+    };
+    for(const auto type : common_types) {
+        create(type);
+    }
+    for(const auto type : handled_packet_types()) {
+        create(type);
+    }
+    if(packet_seconds_other == nullptr) {
+        packet_seconds_other = &metrics.histogram("plink_packet_seconds", "time to process a packet by type", "type=\"other\"");
+    }
+}
+
+auto Server::observe_packet(const net::PacketType type, const std::chrono::steady_clock::time_point start) -> void {
+    const auto it = packet_seconds.find(type);
+    (it != packet_seconds.end() ? it->second : packet_seconds_other)->observe_since(start);
+}
+
+auto attach_backend(Server& server, net::ServerBackend* const backend) -> void {
+    // the derived server is constructed by now, so its packet types are known
+    server.create_packet_metrics();
+    // server.mutex is taken by the sessions themselves around registry mutations,
+    // so that relaying between independent links never waits on each other
+    backend->alloc_client = [&server](net::ClientData& client) -> coop::Async<void> {
+        const auto ptr = co_await server.alloc_session();
+        server.sessions += 1;
+        server.link_session(ptr);
+        ptr->refused          = !server.admission.admit_accept();
+        ptr->client           = &client;
+        // two pointers fit in std::function without an allocation
+        ptr->parser.send_data = [&server, ptr](PrependableBuffer buffer) -> coop::Async<bool> {
+            auto&      stats = server.queue_stats;
+            const auto size  = buffer.body().size();
+            ptr->queued_bytes += size;
+            stats.queued_bytes += size;
+            stats.peak_queued_bytes = std::max(stats.peak_queued_bytes, ptr->queued_bytes);
+
+            if(ptr->batch) {
+                co_return co_await send_batched(server, *ptr->client, *ptr, std::move(buffer));
+            }
+            const auto lock = co_await ptr->lock_send();
+            PLINK_TRACE_SCOPE(Send, 0, ptr);
+            const auto result = co_await server.backend->send(*ptr->client, std::move(buffer));
+            // ptr may be freed as soon as the lock is released, so update it here
+            finish_write(server, *ptr, size);
+            co_return result;
+        };
+        client.data = ptr;
+    };
+    backend->free_client = [&server](void* ptr) -> coop::Async<void> {
+        const auto session = std::bit_cast<Session*>(ptr);
+        // free_session suspends, so leave the sweep before it
+        server.unlink_session(session);
+        co_await server.free_session(session);
+        server.sessions -= 1;
+    };
+    backend->on_received = [&server](const net::ClientData& client, PrependableBuffer buffer) -> coop::Async<void> {
+        auto& logger  = server.logger;
+        auto& session = *std::bit_cast<Session*>(client.data);
+        session.active = true;
+        coop_unwrap(parsed, net::split_header(buffer.body()));
+        const auto [header, payload] = parsed;
+        // a refused session gets one Error and is closed, packets already received are ignored
+        if(session.refused) {
+            if(!std::exchange(session.refusal_sent, true) && header.type != proto::Error::pt) {
+                co_await session.parser.send_packet(proto::Error(), header.id);
+            }
+            close_refused(server, session);
+            co_return;
+        }
+        // relayed packets are limited by the send queues instead
+        if(!server.is_relay_packet(header.type) && !server.admission.admit_packet(session.packet_bucket)) {
+            if(header.type != proto::Error::pt) {
+                co_await session.parser.send_packet(proto::Error(), header.id);
+            }
+            co_return;
+        }
+        if(header.type == proto::EnableBatch::pt) {
+            session.batch = true;
+            co_await session.parser.send_packet(proto::Success(), header.id);
+            co_return;
+        }
+        if(header.type == proto::DumpTrace::pt) {
+#if defined(PLINK_TRACE)
+            // writes a file on the server, so only when the operator allowed it
+            if(server.trace_dump && session.activated && trace::dump_to_file(logger)) {
+                co_await session.parser.send_packet(proto::Success(), header.id);
+                co_return;
+            }
+#endif
+            co_await session.parser.send_packet(proto::Error(), header.id);
+            co_return;
+        }
+        PLINK_TRACE_SCOPE(Dispatch, header.type, &session);
+        const auto timed = !server.is_relay_packet(header.type);
+        const auto start = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+        if(!co_await session.on_received(header, payload, std::move(buffer)) && header.type != proto::Error::pt /*do not reply to error packet*/) {
+            co_await session.parser.send_packet(proto::Error(), header.id);
+        }
+        if(timed) {
+            server.observe_packet(header.type, start);
+        }
+        if(session.refused) {
+            close_refused(server, session); // rejected certificate, answered above
+        }
+        co_return;
+    };
+    server.backend.reset(backend);
 }
 
 auto run(const int argc, const char* const* const argv, uint16_t port, Server& server, const std::string_view name) -> bool {
     auto session_key_secret_file = (const char*)(nullptr);
     auto user_cert_verifier      = (const char*)(nullptr);
+    auto cert_verifier_plugin    = (const char*)(nullptr);
+    auto verifier_timeout_ms     = uint32_t(server.cert_verifier.timeout.count());
+    auto verifier_jobs           = uint32_t(server.cert_verifier.max_running);
+    auto verifier_pool_size      = uint32_t(0);
+    auto cert_cache_size         = uint32_t(server.cert_cache.capacity);
+    auto cert_cache_ttl_sec      = uint32_t(server.cert_cache.ttl.count());
+    auto send_queue_limit        = uint32_t(server.send_queue_limit);
+    auto send_queue_policy       = (const char*)("pause");
+    auto batch_delay_us          = uint32_t(server.batch_delay.count());
+    auto resume_grace_sec        = uint32_t(server.resume_grace.count());
+    auto resume_backlog_limit    = uint32_t(server.resume_backlog_limit);
+    auto metrics_port            = uint16_t(0);
+    auto idle_trim_sec           = uint32_t(server.idle_trim.count());
+    auto accept_rate             = uint32_t(0);
+    auto accept_burst            = uint32_t(0);
+    auto activation_rate         = uint32_t(0);
+    auto activation_burst        = uint32_t(0);
+    auto packet_rate             = uint32_t(0);
+    auto packet_burst            = uint32_t(0);
+    auto log_async               = uint32_t(0);
+    auto log_level               = (const char*)(nullptr);
+    auto log_burst               = uint32_t(log::config.burst);
+    auto log_sample              = uint32_t(log::config.sample);
     {
-        auto parser = args::Parser<uint16_t, uint8_t>();
+        auto parser = args::Parser<uint16_t, uint8_t, uint32_t>();
         auto help   = false;
         parser.kwflag(&help, {"-h", "--help"}, "print this help message", {.no_error_check = true});
         parser.kwarg(&port, {"-p"}, "PORT", "port number to use", {.state = args::State::DefaultValue});
         parser.kwarg(&session_key_secret_file, {"-k", "--key"}, "FILE", "enable user verification with the secret file", {.state = args::State::Initialized});
         parser.kwarg(&user_cert_verifier, {"-c", "--cert-verifier"}, "EXEC", "full-path of executable to verify user certificate", {.state = args::State::Initialized});
+        parser.kwarg(&cert_verifier_plugin, {"--cert-verifier-plugin"}, "FILE", "shared object to verify user certificate in process", {.state = args::State::Initialized});
+        parser.kwarg(&verifier_timeout_ms, {"--cert-verifier-timeout"}, "MS", "kill the verifier if it does not exit in this time", {.state = args::State::DefaultValue});
+        parser.kwarg(&verifier_jobs, {"--cert-verifier-jobs"}, "N", "maximum number of verifiers running at once", {.state = args::State::DefaultValue});
+        parser.kwarg(&verifier_pool_size, {"--cert-verifier-pool"}, "N", "keep N verifier workers running instead of launching one per activation", {.state = args::State::DefaultValue});
+        parser.kwarg(&cert_cache_size, {"--cert-cache-size"}, "N", "number of verification results to remember, 0 to disable", {.state = args::State::DefaultValue});
+        parser.kwarg(&cert_cache_ttl_sec, {"--cert-cache-ttl"}, "SEC", "how long a verification result is remembered", {.state = args::State::DefaultValue});
+        parser.kwarg(&send_queue_limit, {"--send-queue-limit"}, "BYTES", "maximum bytes queued for a session, 0 for no limit", {.state = args::State::DefaultValue});
+        parser.kwarg(&send_queue_policy, {"--send-queue-policy"}, "pause|drop|disconnect", "what to do with relayed packets when the limit is hit", {.state = args::State::DefaultValue});
+        parser.kwarg(&batch_delay_us, {"--batch-delay"}, "US", "wait this long for more packets to merge into a batch", {.state = args::State::DefaultValue});
+        parser.kwarg(&resume_grace_sec, {"--resume-grace"}, "SEC", "keep pads of a dropped session this long for the client to resume, 0 to disable", {.state = args::State::DefaultValue});
+        parser.kwarg(&resume_backlog_limit, {"--resume-backlog"}, "BYTES", "maximum bytes buffered for a dropped session", {.state = args::State::DefaultValue});
+        parser.kwarg(&metrics_port, {"--metrics-port"}, "PORT", "serve prometheus metrics on localhost, 0 to disable", {.state = args::State::DefaultValue});
+        parser.kwarg(&idle_trim_sec, {"--idle-trim"}, "SEC", "release spare memory of sessions quiet this long, 0 to disable", {.state = args::State::DefaultValue});
+        parser.kwflag(&server.trace_dump, {"--trace-dump"}, "accept DumpTrace packets from activated sessions");
+        parser.kwarg(&accept_rate, {"--accept-rate"}, "N", "sessions accepted per second, 0 for no limit", {.state = args::State::DefaultValue});
+        parser.kwarg(&accept_burst, {"--accept-burst"}, "N", "sessions accepted at once, 0 for the rate", {.state = args::State::DefaultValue});
+        parser.kwarg(&activation_rate, {"--activation-rate"}, "N", "activations per second with each user certificate, 0 for no limit", {.state = args::State::DefaultValue});
+        parser.kwarg(&activation_burst, {"--activation-burst"}, "N", "activations at once with each user certificate, 0 for the rate", {.state = args::State::DefaultValue});
+        parser.kwarg(&packet_rate, {"--packet-rate"}, "N", "control packets per second from each session, 0 for no limit", {.state = args::State::DefaultValue});
+        parser.kwarg(&packet_burst, {"--packet-burst"}, "N", "control packets at once from each session, 0 for the rate", {.state = args::State::DefaultValue});
+        parser.kwarg(&log_async, {"--log-async"}, "N", "write session logs from a background thread through a ring of N records, 0 to write inline", {.state = args::State::DefaultValue});
+        parser.kwarg(&log_level, {"--log-level"}, "error|info|debug", "skip session logs above this level before formatting them, the server log level if not given", {.state = args::State::Initialized});
+        parser.kwarg(&log_burst, {"--log-burst"}, "N", "session logs per second allowed from each call site, 0 for no limit", {.state = args::State::DefaultValue});
+        parser.kwarg(&log_sample, {"--log-sample"}, "N", "after the burst, pass one in N session logs, 0 to drop all", {.state = args::State::DefaultValue});
         if(!parser.parse(argc, argv) || help) {
             std::println("usage: {} {}", name, parser.get_help());
             std::exit(0);
@@ -92,39 +455,114 @@ auto run(const int argc, const char* const* const argv, uint16_t port, Server& s
         server.session_key.emplace(secret);
     }
     if(user_cert_verifier != nullptr) {
-        server.user_cert_verifier = std::filesystem::absolute(user_cert_verifier).string();
+        server.cert_verifier.executable = std::filesystem::absolute(user_cert_verifier).string();
     }
+    if(cert_verifier_plugin != nullptr) {
+        ensure(server.cert_verifier.load_plugin(cert_verifier_plugin, logger));
+    }
+    ensure(verifier_jobs > 0, "verifier jobs must be positive");
+    server.cert_verifier.timeout     = std::chrono::milliseconds(verifier_timeout_ms);
+    server.cert_verifier.max_running = verifier_jobs;
 
-    // setup network backend
-    const auto backend    = new net::enc::ServerBackendEncAdaptor();
-    backend->alloc_client = [&server](net::ClientData& client) -> coop::Async<void> {
-        const auto lock       = co_await coop::LockGuard::lock(server.mutex);
-        const auto ptr        = co_await server.alloc_session();
-        ptr->parser.send_data = [&server, &client](PrependableBuffer buffer) -> coop::Async<bool> {
-            return server.backend->send(client, std::move(buffer));
-        };
-        client.data = ptr;
-    };
-    backend->free_client = [&server](void* ptr) -> coop::Async<void> {
-        const auto lock = co_await coop::LockGuard::lock(server.mutex);
-        co_await server.free_session(std::bit_cast<Session*>(ptr));
-    };
-    backend->on_received = [&server, &logger](const net::ClientData& client, PrependableBuffer buffer) -> coop::Async<void> {
-        const auto lock    = co_await coop::LockGuard::lock(server.mutex);
-        auto&      session = *std::bit_cast<Session*>(client.data);
-        coop_unwrap(parsed, net::split_header(buffer.body()));
-        const auto [header, _] = parsed;
-        if(!co_await session.on_received(std::move(buffer)) && header.type != proto::Error::pt /*do not reply to error packet*/) {
-            co_await session.parser.send_packet(proto::Error(), header.id);
-        }
-        co_return;
+    server.cert_cache.capacity = cert_cache_size;
+    server.cert_cache.ttl      = std::chrono::seconds(cert_cache_ttl_sec);
+
+    server.send_queue_limit = send_queue_limit;
+    if(std::string_view(send_queue_policy) == "pause") {
+        server.send_queue_policy = QueuePolicy::Pause;
+    } else if(std::string_view(send_queue_policy) == "drop") {
+        server.send_queue_policy = QueuePolicy::Drop;
+    } else if(std::string_view(send_queue_policy) == "disconnect") {
+        server.send_queue_policy = QueuePolicy::Disconnect;
+    } else {
+        bail("unknown send queue policy {}", send_queue_policy);
+    }
+    server.batch_delay = std::chrono::microseconds(batch_delay_us);
+
+    server.resume_grace         = std::chrono::seconds(resume_grace_sec);
+    server.resume_backlog_limit = resume_backlog_limit;
+    server.idle_trim            = std::chrono::seconds(idle_trim_sec);
+
+    const auto rate_limit = [](const uint32_t rate, const uint32_t burst) {
+        return RateLimit{double(rate), double(burst != 0 ? burst : rate)};
     };
-    server.backend.reset(backend);
+    server.admission.accept     = rate_limit(accept_rate, accept_burst);
+    server.admission.activation = rate_limit(activation_rate, activation_burst);
+    server.admission.packet     = rate_limit(packet_rate, packet_burst);
+
+    if(log_level == nullptr) {
+        // follow the level detected by the logger, so the prefilter drops what it would not print anyway
+        log::config.level = logger.loglevel >= Loglevel::Debug ? log::Level::Debug
+                            : logger.loglevel >= Loglevel::Info ? log::Level::Info
+                                                                 : log::Level::Error;
+    } else if(std::string_view(log_level) == "error") {
+        log::config.level = log::Level::Error;
+    } else if(std::string_view(log_level) == "info") {
+        log::config.level = log::Level::Info;
+    } else if(std::string_view(log_level) == "debug") {
+        log::config.level = log::Level::Debug;
+    } else {
+        bail("unknown log level {}", log_level);
+    }
+    log::config.burst  = log_burst;
+    log::config.sample = log_sample;
+    if(log_async > 0) {
+        ensure(log::start(logger, log_async));
+    }
+
+    if(verifier_pool_size > 0) {
+        ensure(server.cert_verifier.enabled(), "verifier pool requires a verifier");
+        ensure(server.cert_verifier.start_pool(verifier_pool_size, logger));
+    }
+
+    // setup network backend
+    // it cannot close a single connection, so close_client stays unset and refused sessions are ignored instead
+    const auto backend = new net::enc::ServerBackendEncAdaptor();
+    attach_backend(server, backend);
+
+    // setup metrics
+    // these live in run() until the runner stops
+    auto& metrics      = server.metrics;
+    auto& sessions     = metrics.gauge("plink_sessions", "connected sessions");
+    auto& queued       = metrics.gauge("plink_send_queue_bytes", "bytes waiting to be sent");
+    auto& dropped      = metrics.counter("plink_send_queue_dropped_total", "packets dropped on full send queues");
+    auto& disconnected = metrics.counter("plink_send_queue_disconnected_total", "links broken on full send queues");
+    auto& cache_hits   = metrics.counter("plink_cert_cache_hits_total", "certificate verification cache hits");
+    auto& cache_misses = metrics.counter("plink_cert_cache_misses_total", "certificate verification cache misses");
+
+    auto& refused_accepts     = metrics.counter("plink_admission_refused_total", "requests refused by rate limits", "reason=\"accept\"");
+    auto& refused_activations = metrics.counter("plink_admission_refused_total", "requests refused by rate limits", "reason=\"activation\"");
+    auto& refused_packets     = metrics.counter("plink_admission_refused_total", "requests refused by rate limits", "reason=\"packet\"");
+    metrics.collectors.push_back([&] {
+        sessions.value     = double(server.sessions);
+        queued.value       = double(server.queue_stats.queued_bytes);
+        dropped.value      = server.queue_stats.dropped;
+        disconnected.value = server.queue_stats.disconnected;
+        cache_hits.value   = server.cert_cache.hits;
+        cache_misses.value = server.cert_cache.misses;
+
+        refused_accepts.value     = server.admission.refused_accepts;
+        refused_activations.value = server.admission.refused_activations;
+        refused_packets.value     = server.admission.refused_packets;
+    });
 
     // run
-    auto runner = coop::Runner();
+    auto runner                 = coop::Runner();
+    server.runner               = &runner;
+    server.cert_verifier.runner = &runner;
     runner.push_task(backend->start(new net::tcp::TCPServerBackend(), port));
+    if(metrics_port != 0) {
+        runner.push_task(metrics::serve(metrics, metrics_port, runner, logger));
+    }
+    if(server.idle_trim.count() > 0) {
+        runner.push_task(sweep_idle(server));
+    }
+#if defined(PLINK_TRACE)
+    trace::install_signal_handler();
+    runner.push_task(trace::watch_signal(logger));
+#endif
     runner.run();
+    log::stop();
 
     return true;
 }
@@ -1,35 +1,156 @@
 #pragma once
+#include <chrono>
+#include <functional>
+#include <span>
+#include <unordered_map>
+
+#include <coop/lock-guard.hpp>
 #include <coop/mutex.hpp>
+#include <coop/runner-pre.hpp>
+#include <coop/single-event.hpp>
 
+#include "admission.hpp"
+#include "cert-cache.hpp"
+#include "cert-verifier.hpp"
+#include "metrics.hpp"
 #include "net/backend.hpp"
 #include "net/packet-parser.hpp"
 #include "session-key.hpp"
+#include "trace.hpp"
 #include "util/logger-pre.hpp"
 
 namespace plink {
 struct Server;
 
+// rehashing walks every node, so it is done only once most buckets are unused
+template <class Table>
+auto shrink_table(Table& table) -> void {
+    if(table.bucket_count() > 16 && table.load_factor() < table.max_load_factor() / 4) {
+        table.rehash(0);
+    }
+}
+
 struct Session {
-    net::PacketParser parser;
-    bool              activated = false;
+    net::PacketParser                     parser;
+    const net::ClientData*                client = nullptr;
+    coop::Mutex                           send_mutex;       // serializes writes to this session from any other session
+    size_t                                queued_bytes = 0; // being written or waiting for send_mutex
+    std::vector<coop::SingleEvent*>       space_waiters;
+    std::vector<PrependableBuffer>        batched;               // packets waiting to be merged into a Batch
+    std::vector<PrependableBuffer>        writing;               // taken from batched by the writer, its capacity is reused until trimmed
+    bool                                  batch         = false; // client accepted Batch
+    bool                                  batch_writing = false; // someone is flushing batched
+    std::chrono::steady_clock::time_point last_write;
+    bool                                  activated    = false;
+    bool                                  active       = true;    // received a packet since the last idle sweep
+    bool                                  refused      = false;   // over the accept limit or certificate rejected, closed after one Error
+    bool                                  refusal_sent = false;   // the one Error a refused session gets
+    TokenBucket                           packet_bucket;
+    Session*                              prev         = nullptr; // in Server::session_list
+    Session*                              next         = nullptr;
 
-    auto         handle_activation(net::BytesRef payload, Server& server) -> bool;
-    virtual auto on_received(PrependableBuffer buffer) -> coop::Async<bool> = 0;
+    auto         handle_activation(net::BytesRef payload, Server& server) -> coop::Async<bool>;
+#if defined(PLINK_TRACE)
+    auto         lock_send() -> coop::Async<coop::LockGuard>; // records the wait
+#else
+    auto         lock_send() {
+        return coop::LockGuard::lock(send_mutex);
+    }
+#endif
+    auto         wait_for_senders() -> coop::Async<void>;
+    auto         wait_for_space() -> coop::Async<void>;
+    auto         wake_space_waiters() -> void;
+    // header and payload are already split from buffer by the caller
+    virtual auto on_received(net::Header header, net::BytesRef payload, PrependableBuffer buffer) -> coop::Async<bool> = 0;
+    // releases spare capacity after the session stayed quiet for a while, it grows back on demand
+    virtual auto trim() -> void;
 
     virtual ~Session() {}
 };
 
+// what to do with a relayed packet when the receiver's send queue is full
+enum class QueuePolicy {
+    Pause,      // make the sender wait until the queue drains
+    Drop,       // discard the packet
+    Disconnect, // break the link
+};
+
+struct QueueStats {
+    size_t queued_bytes      = 0; // total of all sessions
+    size_t peak_queued_bytes = 0; // largest queue of a single session so far
+    size_t paused            = 0;
+    size_t dropped           = 0;
+    size_t disconnected      = 0;
+};
+
 struct Server {
     std::unique_ptr<net::ServerBackend> backend;
     std::optional<SessionKey>           session_key;
-    std::string                         user_cert_verifier;
-    coop::Mutex                         mutex;
+    CertVerifier                        cert_verifier;
+    CertCache                           cert_cache;
+    Admission                           admission;
+    coop::Mutex                         mutex; // guards registry mutations only, never held while relaying payloads
+    size_t                              send_queue_limit  = 0; // per session, in bytes, 0 for no limit
+    QueuePolicy                         send_queue_policy = QueuePolicy::Pause;
+    QueueStats                          queue_stats;
+    std::chrono::microseconds           batch_delay          = {};                       // how long to wait for more packets to merge
+    std::chrono::seconds                resume_grace         = std::chrono::seconds(10); // how long a lost session can be resumed, 0 to disable
+    size_t                              resume_backlog_limit = 1024 * 1024;              // bytes buffered for a lost session
+    std::chrono::seconds                idle_trim            = {};                       // sweep interval for trimming quiet sessions, 0 to disable
+    bool                                trace_dump           = false;                    // accept DumpTrace from activated sessions, SIGUSR1 works regardless
+    Session*                            session_list         = nullptr;                  // every connected session, for the sweep
+    Session*                            sweep_cursor         = nullptr;                  // next session of the sweep in progress, moved on by unlink_session
+    coop::Runner*                       runner               = nullptr;                  // runs timers, such as the grace period of parked sessions
     Logger                              logger;
 
+    // closes one connection, set by the driver if the backend can
+    std::function<void(const net::ClientData&)> close_client;
+
+    // metrics
+    // hot paths only bump plain fields, which collectors copy into the registry on scrape
+    metrics::Registry                                        metrics;
+    metrics::Histogram&                                      activation_seconds = metrics.histogram("plink_activation_seconds", "time to activate a session");
+    metrics::Histogram&                                      verifier_seconds   = metrics.histogram("plink_verifier_seconds", "time spent in the user certificate verifier");
+    std::unordered_map<net::PacketType, metrics::Histogram*> packet_seconds;                 // by handled packet type, fixed by attach_backend
+    metrics::Histogram*                                      packet_seconds_other = nullptr; // any other type, so that clients cannot add series
+    size_t                                                   sessions = 0;
+
+    auto create_packet_metrics() -> void;
+    auto observe_packet(net::PacketType type, std::chrono::steady_clock::time_point start) -> void;
+    auto link_session(Session* session) -> void;
+    auto unlink_session(Session* session) -> void;
+    // trims sessions which received nothing since the previous call, then the server itself
+    // yields between chunks of sessions, so that a large server keeps relaying meanwhile
+    auto trim_idle() -> coop::Async<size_t>;
+
+#if defined(PLINK_TRACE)
+    auto lock_registry() -> coop::Async<coop::LockGuard>; // records the wait
+#else
+    auto lock_registry() {
+        return coop::LockGuard::lock(mutex);
+    }
+#endif
+
+    // relayed packets are not timed, so that metrics cost nothing on the relay path
+    virtual auto is_relay_packet(net::PacketType /*type*/) const -> bool {
+        return false;
+    }
+    // packet types with their own histogram
+    virtual auto handled_packet_types() const -> std::span<const net::PacketType> {
+        return {};
+    }
+    // releases memory kept for reuse, such as empty pool chunks
+    virtual auto trim() -> void {}
     virtual auto alloc_session() -> coop::Async<Session*>        = 0;
     virtual auto free_session(Session* ptr) -> coop::Async<void> = 0;
     virtual ~Server() {};
 };
 
+// routes sessions of backend to server, which takes the ownership
+auto attach_backend(Server& server, net::ServerBackend* backend) -> void;
 auto run(int argc, const char* const* argv, uint16_t port, Server& server, std::string_view name) -> bool;
+
+// defined next to main of each server, for drivers linking the servers in process
+auto create_peer_linker() -> std::unique_ptr<Server>;
+auto create_channel_hub() -> std::unique_ptr<Server>;
 } // namespace plink
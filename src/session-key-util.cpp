@@ -1,3 +1,8 @@
+#include <chrono>
+#include <cstring>
+
+#include "crypto/base64.hpp"
+#include "crypto/hmac.hpp"
 #include "macros/unwrap.hpp"
 #include "session-key.hpp"
 #include "util/argument-parser.hpp"
@@ -22,15 +27,56 @@ auto verify_cert(const char* const secret_file, const char* const content_file)
     const auto [hash_str, content] = parsed;
     return key.verify_user_certificate_hash(hash_str, content);
 }
+
+template <class F>
+auto measure(const char* const label, F func) -> bool {
+    constexpr auto duration = std::chrono::seconds(1);
+
+    const auto begin = std::chrono::steady_clock::now();
+    auto       count = 0uz;
+    auto       now   = begin;
+    while(now - begin < duration) {
+        // check the clock every 1024 runs to keep its cost out of the result
+        for(auto i = 0; i < 1024; i += 1) {
+            ensure(func());
+        }
+        count += 1024;
+        now = std::chrono::steady_clock::now();
+    }
+    const auto sec = std::chrono::duration<double>(now - begin).count();
+    std::println("{}: {:.0f} verifications/s", label, count / sec);
+    return true;
+}
+
+auto bench_verify(const char* const secret_file, const char* const content_file) -> bool {
+    unwrap(secret, read_file(secret_file));
+    unwrap(cert, read_file(content_file));
+    auto key = SessionKey(secret);
+    unwrap(parsed, key.split_user_certificate_to_hash_and_content(from_span(cert)));
+    const auto [hash_str, content] = parsed;
+    ensure(key.verify_user_certificate_hash(hash_str, content), "certificate is not valid");
+
+    // what verify_user_certificate_hash used to do, for comparison
+    const auto reference = [&]() -> bool {
+        unwrap(hash, crypto::base64::decode(hash_str));
+        unwrap(computed_hash, crypto::hmac::compute_hmac_sha256(secret, to_span(content)));
+        return hash.size() == computed_hash.size() && std::memcmp(hash.data(), computed_hash.data(), hash.size()) == 0;
+    };
+    ensure(measure("reference", reference));
+    ensure(measure("session-key", [&] { return key.verify_user_certificate_hash(hash_str, content); }));
+    return true;
+}
 } // namespace
 
 auto main(const int argc, const char* const* const argv) -> int {
     auto secret = (const char*)(nullptr);
     auto file   = (const char*)(nullptr);
     auto verify = false;
+    auto bench  = false;
     auto help   = false;
     auto parser = args::Parser<>();
     parser.kwflag(&verify, {"-d", "--verify"}, "verify user certificate");
+    parser.kwflag(&bench, {"-b", "--bench"}, "measure user certificate verifications per second on a single core");
     parser.kwflag(&help, {"-h", "--help"}, "print this help message", {.no_error_check = true});
     parser.arg(&secret, "SECRET_FILE", "path to key file");
     parser.arg(&file, "TARGET_FILE", "path to data or cert file");
@@ -39,7 +85,9 @@ auto main(const int argc, const char* const* const argv) -> int {
         return 1;
     }
 
-    if(!verify) {
+    if(bench) {
+        return bench_verify(secret, file) ? 0 : 1;
+    } else if(!verify) {
         return generate_cert(secret, file) ? 0 : 1;
     } else {
         std::println("{}", verify_cert(secret, file) ? "ok" : "fail");
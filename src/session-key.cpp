@@ -1,12 +1,57 @@
-#include <cstring>
-
 #include "crypto/base64.hpp"
-#include "crypto/hmac.hpp"
 #include "macros/unwrap.hpp"
 #include "util/span.hpp"
 
 #include "session-key.hpp"
 
+namespace {
+using plink::Sha256;
+
+// decodes base64 encoded digest into a fixed size array, without allocation
+auto decode_digest(const std::string_view str) -> std::optional<Sha256::Digest> {
+    constexpr auto encoded_size = (Sha256::digest_size + 2) / 3 * 4;
+    constexpr auto padding      = encoded_size / 4 * 3 - Sha256::digest_size;
+
+    ensure(str.size() == encoded_size, "not a valid certification hash");
+    ensure(str.substr(encoded_size - padding) == std::string_view("==").substr(0, padding), "not a base64 encoded string");
+
+    const auto decode_char = [](const char c) -> int {
+        if(c >= 'A' && c <= 'Z') {
+            return c - 'A';
+        } else if(c >= 'a' && c <= 'z') {
+            return c - 'a' + 26;
+        } else if(c >= '0' && c <= '9') {
+            return c - '0' + 52;
+        } else if(c == '+') {
+            return 62;
+        } else if(c == '/') {
+            return 63;
+        } else {
+            return -1;
+        }
+    };
+
+    auto digest = Sha256::Digest();
+    auto bits   = uint32_t(0);
+    auto nbits  = 0;
+    auto pos    = 0uz;
+    for(const auto c : str.substr(0, encoded_size - padding)) {
+        const auto value = decode_char(c);
+        ensure(value >= 0, "not a base64 encoded string");
+        bits = bits << 6 | uint32_t(value);
+        nbits += 6;
+        if(nbits >= 8) {
+            nbits -= 8;
+            ensure(pos < digest.size(), "not a valid certification hash");
+            digest[pos] = std::byte(bits >> nbits);
+            pos += 1;
+        }
+    }
+    ensure(pos == digest.size(), "not a valid certification hash");
+    return digest;
+}
+} // namespace
+
 auto SessionKey::split_user_certificate_to_hash_and_content(const std::string_view cert) -> std::optional<std::array<std::string_view, 2>> {
     const auto lf = cert.find('\n');
     ensure(lf != cert.npos);
@@ -15,20 +60,44 @@ auto SessionKey::split_user_certificate_to_hash_and_content(const std::string_vi
     return std::array{hash_str, content};
 }
 
+auto SessionKey::compute_hash(const std::string_view content) const -> Sha256::Digest {
+    auto       inner_ctx = inner;
+    const auto digest    = inner_ctx.update(to_span(content)).finish();
+    auto       outer_ctx = outer;
+    return outer_ctx.update(digest).finish();
+}
+
 auto SessionKey::generate_user_certificate(const std::string_view content) -> std::optional<std::string> {
-    unwrap(hash, crypto::hmac::compute_hmac_sha256(secret, to_span(content)));
+    const auto hash     = compute_hash(content);
     const auto hash_str = crypto::base64::encode(hash);
     return std::format("{}\n{}", hash_str, content);
 }
 
 auto SessionKey::verify_user_certificate_hash(const std::string_view hash_str, const std::string_view content) -> bool {
-    ensure(hash_str.size() % 4 == 0, "not a base64 encoded string");
-    unwrap(hash, crypto::base64::decode(hash_str));
-    unwrap(computed_hash, crypto::hmac::compute_hmac_sha256(secret, to_span(content)));
-    ensure(hash.size() == computed_hash.size(), "not a valid certification hash");
-    ensure(std::memcmp(hash.data(), computed_hash.data(), hash.size()) == 0, "hash mismatched");
+    unwrap(hash, decode_digest(hash_str));
+    const auto computed_hash = compute_hash(content);
+    // compare in constant time
+    auto diff = std::byte(0);
+    for(auto i = 0uz; i < hash.size(); i += 1) {
+        diff |= hash[i] ^ computed_hash[i];
+    }
+    ensure(diff == std::byte(0), "hash mismatched");
     return true;
 }
 
-SessionKey::SessionKey(std::vector<std::byte> secret)
-    : secret(secret) {}
+SessionKey::SessionKey(std::vector<std::byte> secret) {
+    // rfc 2104: keys longer than the block size are hashed first
+    if(secret.size() > Sha256::block_size) {
+        const auto digest = Sha256().update(secret).finish();
+        secret.assign(digest.begin(), digest.end());
+    }
+    auto ipad = std::array<std::byte, Sha256::block_size>();
+    auto opad = std::array<std::byte, Sha256::block_size>();
+    for(auto i = 0uz; i < Sha256::block_size; i += 1) {
+        const auto k = i < secret.size() ? secret[i] : std::byte(0);
+        ipad[i]      = k ^ std::byte(0x36);
+        opad[i]      = k ^ std::byte(0x5c);
+    }
+    inner.update(ipad);
+    outer.update(opad);
+}
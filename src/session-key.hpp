@@ -4,13 +4,18 @@
 #include <string_view>
 #include <vector>
 
+#include "sha256.hpp"
+
 class SessionKey {
   private:
-    std::vector<std::byte> secret;
+    // hmac states after absorbing the padded key, copied for each computation
+    plink::Sha256 inner;
+    plink::Sha256 outer;
 
   public:
     static auto split_user_certificate_to_hash_and_content(std::string_view cert) -> std::optional<std::array<std::string_view, 2>>;
 
+    auto compute_hash(std::string_view content) const -> plink::Sha256::Digest;
     auto generate_user_certificate(std::string_view content) -> std::optional<std::string>;
     auto verify_user_certificate_hash(std::string_view hash_str, std::string_view content) -> bool;
 
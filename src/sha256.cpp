@@ -0,0 +1,108 @@
+#include <bit>
+#include <cstring>
+
+#include "sha256.hpp"
+
+namespace plink {
+namespace {
+constexpr auto round_constants = std::array<uint32_t, 64>{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+auto load_be32(const std::byte* const ptr) -> uint32_t {
+    return uint32_t(ptr[0]) << 24 | uint32_t(ptr[1]) << 16 | uint32_t(ptr[2]) << 8 | uint32_t(ptr[3]);
+}
+} // namespace
+
+auto Sha256::process_block(const std::byte* const block) -> void {
+    auto w = std::array<uint32_t, 64>();
+    for(auto i = 0uz; i < 16; i += 1) {
+        w[i] = load_be32(block + i * 4);
+    }
+    for(auto i = 16uz; i < 64; i += 1) {
+        const auto s0 = std::rotr(w[i - 15], 7) ^ std::rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const auto s1 = std::rotr(w[i - 2], 17) ^ std::rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i]          = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    auto [a, b, c, d, e, f, g, h] = state;
+    for(auto i = 0uz; i < 64; i += 1) {
+        const auto s1 = std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25);
+        const auto ch = (e & f) ^ (~e & g);
+        const auto t1 = h + s1 + ch + round_constants[i] + w[i];
+        const auto s0 = std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22);
+        const auto mj = (a & b) ^ (a & c) ^ (b & c);
+        const auto t2 = s0 + mj;
+        h             = g;
+        g             = f;
+        f             = e;
+        e             = d + t1;
+        d             = c;
+        c             = b;
+        b             = a;
+        a             = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+auto Sha256::update(std::span<const std::byte> data) -> Sha256& {
+    total += data.size();
+    if(buffered > 0) {
+        const auto len = std::min(block_size - buffered, data.size());
+        std::memcpy(buffer.data() + buffered, data.data(), len);
+        buffered += len;
+        data = data.subspan(len);
+        if(buffered < block_size) {
+            return *this;
+        }
+        process_block(buffer.data());
+        buffered = 0;
+    }
+    while(data.size() >= block_size) {
+        process_block(data.data());
+        data = data.subspan(block_size);
+    }
+    std::memcpy(buffer.data(), data.data(), data.size());
+    buffered = data.size();
+    return *this;
+}
+
+auto Sha256::finish() -> Digest {
+    const auto bits = total * 8;
+
+    auto padding = std::array<std::byte, block_size + 8>();
+    padding[0]   = std::byte(0x80);
+    // pad until 8 bytes are left in the block, then append the length
+    const auto pad_size = (buffered < block_size - 8 ? block_size - 8 : block_size * 2 - 8) - buffered;
+    for(auto i = 0uz; i < 8; i += 1) {
+        padding[pad_size + i] = std::byte(bits >> (56 - i * 8));
+    }
+    update(std::span(padding.data(), pad_size + 8));
+
+    auto digest = Digest();
+    for(auto i = 0uz; i < state.size(); i += 1) {
+        digest[i * 4 + 0] = std::byte(state[i] >> 24);
+        digest[i * 4 + 1] = std::byte(state[i] >> 16);
+        digest[i * 4 + 2] = std::byte(state[i] >> 8);
+        digest[i * 4 + 3] = std::byte(state[i]);
+    }
+    return digest;
+}
+
+Sha256::Sha256()
+    : state{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19} {}
+} // namespace plink
@@ -0,0 +1,32 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace plink {
+// minimal sha-256 whose intermediate state can be copied,
+// so that the hmac key schedule is computed only once per key
+// checked against the fips 180-4 and rfc 4231 vectors in tests/plink.cpp
+class Sha256 {
+  public:
+    constexpr static auto digest_size = 32uz;
+    constexpr static auto block_size  = 64uz;
+
+    using Digest = std::array<std::byte, digest_size>;
+
+  private:
+    std::array<uint32_t, 8>           state;
+    std::array<std::byte, block_size> buffer;
+    size_t                            buffered = 0;
+    uint64_t                          total    = 0;
+
+    auto process_block(const std::byte* block) -> void;
+
+  public:
+    auto update(std::span<const std::byte> data) -> Sha256&;
+    auto finish() -> Digest;
+
+    Sha256();
+};
+} // namespace plink
@@ -0,0 +1,68 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <string_view>
+#include <utility>
+
+namespace plink {
+// string kept inline up to capacity bytes, so that typical names need no allocation
+// longer ones fall back to the heap
+template <size_t capacity>
+struct SmallString {
+    // private
+    std::array<char, capacity> buffer;
+    std::unique_ptr<char[]>    heap;
+    uint32_t                   size = 0;
+
+    auto view() const -> std::string_view {
+        return {heap ? heap.get() : buffer.data(), size};
+    }
+
+    operator std::string_view() const {
+        return view();
+    }
+
+    auto operator==(const std::string_view other) const -> bool {
+        return view() == other;
+    }
+
+    auto operator=(SmallString other) -> SmallString& {
+        buffer = other.buffer;
+        heap   = std::move(other.heap);
+        size   = std::exchange(other.size, 0);
+        return *this;
+    }
+
+    SmallString() = default;
+
+    explicit SmallString(const std::string_view str)
+        : size(uint32_t(str.size())) {
+        auto dest = buffer.data();
+        if(str.size() > capacity) {
+            heap.reset(new char[str.size()]);
+            dest = heap.get();
+        }
+        std::memcpy(dest, str.data(), str.size());
+    }
+
+    SmallString(const SmallString& other)
+        : SmallString(other.view()) {
+    }
+
+    SmallString(SmallString&& other)
+        : buffer(other.buffer),
+          heap(std::move(other.heap)),
+          size(std::exchange(other.size, 0)) {
+    }
+};
+} // namespace plink
+
+template <size_t capacity>
+struct std::formatter<plink::SmallString<capacity>> : std::formatter<std::string_view> {
+    auto format(const plink::SmallString<capacity>& str, auto& ctx) const {
+        return std::formatter<std::string_view>::format(str.view(), ctx);
+    }
+};
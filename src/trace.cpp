@@ -0,0 +1,97 @@
+#include <array>
+#include <atomic>
+#include <csignal>
+#include <format>
+#include <fstream>
+
+#include <coop/timer.hpp>
+
+#include "macros/logger.hpp"
+#include "trace.hpp"
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+namespace plink::trace {
+namespace {
+constexpr auto ring_size     = 1uz << 16; // must be a power of two
+constexpr auto poll_interval = std::chrono::milliseconds(200);
+
+constexpr auto stage_names = std::array{
+    "dispatch",      // Dispatch
+    "registry-wait", // RegistryWait
+    "send-wait",     // SendWait
+    "send",          // Send
+};
+
+auto ring      = std::array<Record, ring_size>();
+auto written   = 0uz; // total records, the ring holds the last ring_size of them
+auto dumps     = 0uz;
+auto requested = std::atomic_bool(false);
+
+auto on_signal(int /*signal*/) -> void {
+    requested.store(true, std::memory_order_relaxed);
+}
+} // namespace
+
+auto record(const Record& record) -> void {
+    ring[written & (ring_size - 1)] = record;
+    written += 1;
+}
+
+auto dump(const char* const path) -> bool {
+    auto file = std::ofstream(path);
+    if(!file) {
+        return false;
+    }
+    const auto to_us = [](const std::chrono::steady_clock::duration duration) {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    };
+    file << R"({"displayTimeUnit":"ns","traceEvents":[)";
+    const auto first = written > ring_size ? written - ring_size : 0;
+    for(auto i = first; i < written; i += 1) {
+        const auto& r = ring[i & (ring_size - 1)];
+        file << std::format(R"({}{{"name":"{}","cat":"plink","ph":"X","pid":1,"tid":{},"ts":{:.3f},"dur":{:.3f},"args":{{"type":{}}}}})",
+                            i == first ? "" : ",\n",
+                            stage_names[size_t(r.stage)],
+                            uintptr_t(r.session) >> 4,
+                            to_us(r.begin.time_since_epoch()),
+                            to_us(r.end - r.begin),
+                            r.type);
+    }
+    file << "]}\n";
+    return bool(file);
+}
+
+auto dump_to_file(Logger& logger) -> bool {
+#if defined(_WIN32)
+    const auto pid = 0;
+#else
+    const auto pid = getpid();
+#endif
+    const auto path = std::format("plink-trace-{}-{}.json", pid, dumps);
+    dumps += 1;
+    if(!dump(path.data())) {
+        LOG_ERROR(logger, "failed to write trace to {}", path);
+        return false;
+    }
+    LOG_INFO(logger, "trace written to {}", path);
+    return true;
+}
+
+auto install_signal_handler() -> void {
+#if !defined(_WIN32)
+    std::signal(SIGUSR1, on_signal);
+#endif
+}
+
+auto watch_signal(Logger& logger) -> coop::Async<bool> {
+    while(true) {
+        if(requested.exchange(false, std::memory_order_relaxed)) {
+            dump_to_file(logger);
+        }
+        co_await coop::sleep(poll_interval);
+    }
+}
+} // namespace plink::trace
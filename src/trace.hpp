@@ -0,0 +1,54 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+#include <coop/generator.hpp>
+
+#include "util/logger-pre.hpp"
+
+// per-packet lifecycle trace, kept in a fixed-size ring and dumped as chrome trace json
+// only compiled in when built with -Dtrace=true, otherwise the macros below expand to nothing
+namespace plink::trace {
+enum class Stage : uint8_t {
+    Dispatch,     // Session::on_received, including everything below
+    RegistryWait, // waiting for Server::mutex
+    SendWait,     // waiting for Session::send_mutex
+    Send,         // ServerBackend::send, including encryption
+};
+
+struct Record {
+    std::chrono::steady_clock::time_point begin;
+    std::chrono::steady_clock::time_point end;
+    const void*                           session;
+    uint16_t                              type; // packet type, or 0 if unknown
+    Stage                                 stage;
+};
+
+// the ring is only touched from the runner thread, the signal handler just raises a flag
+auto record(const Record& record) -> void;
+auto dump(const char* path) -> bool;
+auto install_signal_handler() -> void;
+// dumps to plink-trace-<pid>-<n>.json each time SIGUSR1 arrives
+auto watch_signal(Logger& logger) -> coop::Async<bool>;
+auto dump_to_file(Logger& logger) -> bool;
+
+struct Scope {
+    Stage                                 stage;
+    uint16_t                              type;
+    const void*                           session;
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+    ~Scope() {
+        record({begin, std::chrono::steady_clock::now(), session, type, stage});
+    }
+};
+} // namespace plink::trace
+
+#if defined(PLINK_TRACE)
+#define PLINK_TRACE_CONCAT_(a, b) a##b
+#define PLINK_TRACE_CONCAT(a, b)  PLINK_TRACE_CONCAT_(a, b)
+#define PLINK_TRACE_SCOPE(stage, type, session) \
+    const auto PLINK_TRACE_CONCAT(plink_trace_scope_, __LINE__) = ::plink::trace::Scope{::plink::trace::Stage::stage, uint16_t(type), session}
+#else
+#define PLINK_TRACE_SCOPE(stage, type, session)
+#endif
@@ -0,0 +1,24 @@
+#include <coop/runner.hpp>
+#include <coop/timer.hpp>
+
+#include "watchdog.hpp"
+
+namespace plink {
+namespace {
+auto fire(const std::shared_ptr<std::function<void()>> expire, const std::chrono::steady_clock::time_point deadline) -> coop::Async<void> {
+    co_await coop::sleep(deadline - std::chrono::steady_clock::now());
+    if(*expire) {
+        (*expire)();
+    }
+}
+} // namespace
+
+Watchdog::Watchdog(coop::Runner& runner, const std::chrono::steady_clock::time_point deadline, std::function<void()> expire)
+    : expire(std::make_shared<std::function<void()>>(std::move(expire))) {
+    runner.push_task(fire(this->expire, deadline));
+}
+
+Watchdog::~Watchdog() {
+    *expire = nullptr;
+}
+} // namespace plink
@@ -0,0 +1,18 @@
+#pragma once
+#include <chrono>
+#include <functional>
+#include <memory>
+
+#include <coop/runner-pre.hpp>
+
+namespace plink {
+// runs expire at the deadline unless destroyed first
+// breaks waits which have no timeout of their own, e.g. by killing the process or shutting down the socket waited on
+struct Watchdog {
+    // private
+    std::shared_ptr<std::function<void()>> expire; // shared with the timer task, which outlives this
+
+    Watchdog(coop::Runner& runner, std::chrono::steady_clock::time_point deadline, std::function<void()> expire);
+    ~Watchdog();
+};
+} // namespace plink
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <print>
+
+#include <coop/generator.hpp>
+#include <coop/runner.hpp>
+#include <coop/single-event.hpp>
+#include <coop/timer.hpp>
+
+#include "macros/coop-unwrap.hpp"
+#include "plink/buffer-util.hpp"
+#include "plink/channel-hub-client.hpp"
+#include "plink/peer-linker-client.hpp"
+#include "util/argument-parser.hpp"
+
+// load generator for a local peer-linker and channel-hub
+// prints one json object with latency percentiles and relay throughput
+namespace {
+using Clock    = std::chrono::steady_clock;
+using Client   = plink::PeerLinkerClientBackend;
+using Samples  = std::vector<Clock::duration>;
+using PeerInfo = Client::Params::PeerInfo;
+
+struct Config {
+    const char* host         = "localhost";
+    uint16_t    plink_port   = 8080;
+    uint16_t    chub_port    = 8081;
+    uint32_t    pairs        = 100;
+    uint32_t    packets      = 1000; // per pair
+    uint32_t    size         = 64;   // payload bytes, at least the timestamp
+    uint32_t    rate         = 0;    // packets per second per pair, 0 for as fast as possible
+    uint32_t    timeout      = 30;   // seconds for the whole run
+    uint32_t    pad_requests = 0;    // channel-hub pad requests to measure
+    bool        batch        = false;
+};
+
+struct Stats {
+    Samples register_latency; // connect, activate and register
+    Samples link_latency;     // link including the auth round trip
+    Samples relay_latency;
+    Samples pad_request_latency;
+    size_t  sent     = 0;
+    size_t  received = 0;
+    size_t  failures = 0;
+};
+
+struct Pair {
+    Client            host;
+    Client            guest;
+    std::string       name;
+    bool              registered = false; // or the host failed before it
+    coop::SingleEvent registered_event;
+    bool              host_failed = false;
+    bool              host_done   = false; // received everything, gave up waiting or failed
+    coop::SingleEvent host_done_event;
+    size_t            received = 0;
+};
+
+auto config   = Config();
+auto stats    = Stats();
+auto deadline = Clock::time_point(); // of the whole run
+auto running  = 0uz;                 // tasks not returned yet, set before the runner starts
+
+// put at the top of each task, counts it as returned however it returns
+struct TaskDone {
+    ~TaskDone() {
+        running -= 1;
+    }
+};
+
+auto mark_registered(Pair& pair) -> void {
+    if(!pair.registered) {
+        pair.registered = true;
+        pair.registered_event.notify();
+    }
+}
+
+auto mark_host_done(Pair& pair) -> void {
+    pair.host_done = true;
+    pair.host_done_event.notify();
+}
+
+auto host_task(Pair& pair) -> coop::Async<void> {
+    const auto done = TaskDone();
+    pair.host.on_pad_created  = [&pair] { mark_registered(pair); };
+    pair.host.on_auth_request = [](std::string_view, net::BytesRef) { return true; };
+    pair.host.on_received     = [&pair](PrependableBuffer buffer) -> coop::Async<void> {
+        auto sent_at = Clock::rep();
+        std::memcpy(&sent_at, buffer.body().data(), sizeof(sent_at));
+        stats.relay_latency.push_back(Clock::now() - Clock::time_point(Clock::duration(sent_at)));
+        stats.received += 1;
+        pair.received += 1;
+        co_return;
+    };
+    if(!co_await pair.host.connect({
+           .peer_linker_addr = config.host,
+           .peer_linker_port = config.plink_port,
+           .pad_name         = pair.name,
+           .accept_batch     = config.batch,
+       })) {
+        stats.failures += 1;
+        // let the guest know, it would wait for the pad forever otherwise
+        pair.host_failed = true;
+        mark_registered(pair);
+        mark_host_done(pair);
+        co_return;
+    }
+
+    while(pair.received < config.packets && Clock::now() < deadline) {
+        co_await coop::sleep(std::chrono::milliseconds(10));
+    }
+    if(pair.received < config.packets) {
+        stats.failures += 1;
+    }
+    mark_host_done(pair);
+    co_await pair.host.finish();
+}
+
+auto guest_task(Pair& pair) -> coop::Async<void> {
+    const auto done = TaskDone();
+    if(!pair.registered) {
+        co_await pair.registered_event;
+    }
+    if(pair.host_failed) {
+        co_return;
+    }
+    const auto start = Clock::now();
+    // connect() reports no progress except on_pad_created, so the steps before it are measured together
+    auto registered = Clock::time_point();
+    pair.guest.on_pad_created = [&registered] { registered = Clock::now(); };
+    if(!co_await pair.guest.connect({
+           .peer_linker_addr = config.host,
+           .peer_linker_port = config.plink_port,
+           .pad_name         = pair.name + "-guest",
+           .peer_info        = PeerInfo{pair.name, {}},
+           .accept_batch     = config.batch,
+       })) {
+        stats.failures += 1;
+        co_return;
+    }
+    stats.register_latency.push_back(registered - start);
+    stats.link_latency.push_back(Clock::now() - registered);
+
+    const auto interval = config.rate == 0 ? Clock::duration() : std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1)) / config.rate;
+    const auto padding  = std::vector<std::byte>(config.size - sizeof(Clock::rep));
+    for(auto i = 0u; i < config.packets; i += 1) {
+        auto buffer = PrependableBuffer();
+        buffer.append_object(Clock::now().time_since_epoch().count());
+        plink::append_bytes(buffer, padding);
+        if(!co_await pair.guest.send(std::move(buffer))) {
+            stats.failures += 1;
+            break;
+        }
+        stats.sent += 1;
+        if(interval.count() != 0) {
+            co_await coop::sleep(interval);
+        }
+    }
+    // let the host finish first, so that unlinking does not race with the last packets
+    // the host stops waiting at the deadline, so a lost packet cannot hang this
+    if(!pair.host_done) {
+        co_await pair.host_done_event;
+    }
+    co_await pair.guest.finish();
+}
+
+
+auto pad_request_task() -> coop::Async<void> {
+    const auto done = TaskDone();
+    auto host  = plink::ChannelHubClient();
+    auto guest = plink::ChannelHubClient();
+    auto count = 0;
+    host.on_pad_request = [&count](std::string_view) -> coop::Async<std::optional<std::string>> {
+        count += 1;
+        co_return std::format("bench-pad-{}", count);
+    };
+    if(!co_await host.connect(config.host, config.chub_port) || !co_await guest.connect(config.host, config.chub_port) || !co_await host.register_channel("bench")) {
+        stats.failures += 1;
+        co_return;
+    }
+    for(auto i = 0u; i < config.pad_requests; i += 1) {
+        const auto start = Clock::now();
+        if(!co_await guest.request_pad("bench")) {
+            stats.failures += 1;
+            break;
+        }
+        stats.pad_request_latency.push_back(Clock::now() - start);
+    }
+    co_await host.unregister_channel("bench");
+}
+
+auto percentiles(Samples& samples) -> std::string {
+    if(samples.empty()) {
+        return "null";
+    }
+    std::ranges::sort(samples);
+    const auto at = [&samples](const double p) {
+        const auto index = std::min(samples.size() - 1, size_t(p * double(samples.size())));
+        return std::chrono::duration<double, std::micro>(samples[index]).count();
+    };
+    return std::format(R"({{"count":{},"p50_us":{:.1f},"p99_us":{:.1f},"p999_us":{:.1f},"max_us":{:.1f}}})", samples.size(), at(0.5), at(0.99), at(0.999), at(1.0));
+}
+
+auto print_report(const double elapsed) -> void {
+    std::println(R"({{"pairs":{},"size":{},"sent":{},"received":{},"failures":{},"seconds":{:.3f},"packets_per_sec":{:.1f},"megabytes_per_sec":{:.3f},)"
+                 R"("register":{},"link":{},"relay":{},"pad_request":{}}})",
+                 config.pairs, config.size, stats.sent, stats.received, stats.failures, elapsed,
+                 double(stats.received) / elapsed, double(stats.received) * config.size / elapsed / 1e6,
+                 percentiles(stats.register_latency), percentiles(stats.link_latency), percentiles(stats.relay_latency), percentiles(stats.pad_request_latency));
+}
+
+// a side stuck in a wait without its own timeout, e.g. a host whose guest never linked, keeps the runner alive
+// so report what was measured and exit with failure a little after the deadline
+auto watchdog_task(const Clock::time_point start) -> coop::Async<void> {
+    while(running > 0 && Clock::now() < deadline + std::chrono::seconds(1)) {
+        co_await coop::sleep(std::chrono::milliseconds(100));
+    }
+    if(running > 0) {
+        stats.failures += 1;
+        print_report(std::chrono::duration<double>(Clock::now() - start).count());
+        std::println(stderr, "timed out with {} tasks still waiting", running);
+        std::exit(1);
+    }
+}
+} // namespace
+
+auto main(const int argc, const char* const argv[]) -> int {
+    {
+        auto parser = args::Parser<uint16_t, uint32_t>();
+        auto help   = false;
+        parser.kwflag(&help, {"-h", "--help"}, "print this help message", {.no_error_check = true});
+        parser.kwarg(&config.host, {"--host"}, "HOST", "server address", {.state = args::State::DefaultValue});
+        parser.kwarg(&config.plink_port, {"--plink-port"}, "PORT", "peer-linker port", {.state = args::State::DefaultValue});
+        parser.kwarg(&config.chub_port, {"--chub-port"}, "PORT", "channel-hub port", {.state = args::State::DefaultValue});
+        parser.kwarg(&config.pairs, {"--pairs"}, "N", "concurrent pad pairs", {.state = args::State::DefaultValue});
+        parser.kwarg(&config.packets, {"--packets"}, "N", "payloads sent by each pair", {.state = args::State::DefaultValue});
+        parser.kwarg(&config.size, {"--size"}, "BYTES", "payload size", {.state = args::State::DefaultValue});
+        parser.kwarg(&config.rate, {"--rate"}, "N", "payloads per second per pair, 0 for no limit", {.state = args::State::DefaultValue});
+        parser.kwarg(&config.timeout, {"--timeout"}, "SEC", "give up and fail after this long", {.state = args::State::DefaultValue});
+        parser.kwarg(&config.pad_requests, {"--pad-requests"}, "N", "channel-hub pad requests to measure, 0 to skip", {.state = args::State::DefaultValue});
+        parser.kwflag(&config.batch, {"--batch"}, "let the server merge payloads into batches");
+        if(!parser.parse(argc, argv) || help) {
+            std::println("usage: plink-bench {}", parser.get_help());
+            return 0;
+        }
+    }
+    config.size = std::max(config.size, uint32_t(sizeof(Clock::rep)));
+
+    auto pairs = std::vector<Pair>(config.pairs);
+    for(auto i = 0uz; i < pairs.size(); i += 1) {
+        pairs[i].name = std::format("bench-{}", i);
+    }
+
+    const auto start = Clock::now();
+    deadline         = start + std::chrono::seconds(config.timeout);
+
+    auto runner = coop::Runner();
+    for(auto& pair : pairs) {
+        runner.push_task(host_task(pair));
+        runner.push_task(guest_task(pair));
+        running += 2;
+    }
+    if(config.pad_requests > 0) {
+        runner.push_task(pad_request_task());
+        running += 1;
+    }
+    runner.push_task(watchdog_task(start));
+    runner.run();
+
+    print_report(std::chrono::duration<double>(Clock::now() - start).count());
+    return stats.failures == 0 && stats.received == stats.sent ? 0 : 1;
+}
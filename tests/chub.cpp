@@ -69,11 +69,63 @@ auto pad_request_test() -> coop::Async<bool> {
     co_return true;
 }
 
+auto query_test() -> coop::Async<bool> {
+    auto c1 = plink::ChannelHubClient();
+    coop_ensure(co_await c1.connect("localhost", 8081));
+    coop_ensure(co_await c1.register_channel("query/c"));
+    coop_ensure(co_await c1.register_channel("query/a"));
+    coop_ensure(co_await c1.register_channel("other/a"));
+    coop_ensure(co_await c1.register_channel("query/b"));
+    {
+        coop_unwrap(page, co_await c1.query_channels("query/", "", 2));
+        coop_ensure(page.channels.size() == 2);
+        coop_ensure(page.channels[0] == "query/a");
+        coop_ensure(page.channels[1] == "query/b");
+        coop_ensure(page.next_cursor == "query/b");
+        coop_unwrap(next, co_await c1.query_channels("query/", page.next_cursor, 2));
+        coop_ensure(next.channels.size() == 1);
+        coop_ensure(next.channels[0] == "query/c");
+        coop_ensure(next.next_cursor.empty());
+    }
+    {
+        coop_unwrap(page, co_await c1.query_channels("query/"));
+        coop_ensure(page.channels.size() == 3);
+        coop_ensure(page.next_cursor.empty());
+    }
+    co_return true;
+}
+
+auto subscribe_test() -> coop::Async<bool> {
+    auto c1 = plink::ChannelHubClient();
+    auto c2 = plink::ChannelHubClient();
+    coop_ensure(co_await c1.connect("localhost", 8081));
+    coop_ensure(co_await c2.connect("localhost", 8081));
+    coop_ensure(co_await c2.register_channel("sub1"));
+    {
+        coop_unwrap(channels, co_await c1.subscribe_channels());
+        coop_ensure(std::ranges::find(channels, "sub1") != channels.end());
+    }
+    coop_ensure(co_await c2.register_channel("sub2"));
+    coop_ensure(co_await c2.unregister_channel("sub1"));
+    {
+        coop_unwrap(change, co_await c1.next_channel_change());
+        coop_ensure(change.name == "sub2" && change.added);
+    }
+    {
+        coop_unwrap(change, co_await c1.next_channel_change());
+        coop_ensure(change.name == "sub1" && !change.added);
+    }
+    coop_ensure(co_await c1.unsubscribe_channels());
+    co_return true;
+}
+
 auto pass = false;
 
 auto run_tests() -> coop::Async<void> {
     coop_ensure(co_await reg_unreg_test());
     coop_ensure(co_await pad_request_test());
+    coop_ensure(co_await query_test());
+    coop_ensure(co_await subscribe_test());
     pass = true;
 }
 } // namespace
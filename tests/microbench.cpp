@@ -0,0 +1,336 @@
+#include <array>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <print>
+#include <vector>
+
+#include <unistd.h>
+
+#include <coop/runner.hpp>
+#include <coop/single-event.hpp>
+
+#include "macros/coop-unwrap.hpp"
+#include "plink/alloc-counter.hpp"
+#include "plink/channel-hub-protocol.hpp"
+#include "plink/loopback.hpp"
+#include "plink/peer-linker-protocol.hpp"
+#include "plink/protocol.hpp"
+#include "plink/server.hpp"
+#include "util/argument-parser.hpp"
+
+// microbenchmarks of the server logic, driven in process through the loopback transport
+// prints ns/op and allocs/op of each case
+namespace {
+using Clock = std::chrono::steady_clock;
+
+auto iterations  = uint32_t(100000);
+auto idle_pairs  = uint32_t(50000); // 100k sessions
+auto idle_budget = uint32_t(16384); // resident bytes per idle loopback session, client side included, 0 for no check
+auto failed      = false;
+
+// resident set size of this process
+auto resident_bytes() -> size_t {
+    auto statm = std::ifstream("/proc/self/statm");
+    auto size  = 0uz;
+    auto pages = 0uz;
+    statm >> size >> pages;
+    return pages * size_t(sysconf(_SC_PAGESIZE));
+}
+
+template <class T>
+auto do_not_optimize(T& value) -> void {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+auto report(const std::string_view name, const Clock::duration elapsed, const size_t allocs) -> void {
+    const auto ns = std::chrono::duration<double, std::nano>(elapsed).count();
+    std::println("{:<40} {:>10.1f} ns/op {:>8.2f} allocs/op", name, ns / iterations, double(allocs) / iterations);
+}
+
+template <class Body>
+auto measure(const std::string_view name, Body body) -> void {
+    const auto allocs = plink::alloc_counter::get();
+    const auto start  = Clock::now();
+    for(auto i = 0u; i < iterations; i += 1) {
+        body(i);
+    }
+    report(name, Clock::now() - start, plink::alloc_counter::get() - allocs);
+}
+
+template <class Body>
+auto measure_async(const std::string_view name, Body body) -> coop::Async<bool> {
+    const auto allocs = plink::alloc_counter::get();
+    const auto start  = Clock::now();
+    for(auto i = 0u; i < iterations; i += 1) {
+        if(!co_await body(i)) {
+            std::println("{} failed at {}", name, i);
+            co_return false;
+        }
+    }
+    report(name, Clock::now() - start, plink::alloc_counter::get() - allocs);
+    co_return true;
+}
+
+// serialized packet with its header, as the server receives it
+template <class T>
+auto encode(T packet) -> coop::Async<PrependableBuffer> {
+    auto parser      = net::PacketParser();
+    auto result      = PrependableBuffer();
+    parser.send_data = [&result](PrependableBuffer buffer) -> coop::Async<bool> {
+        result = std::move(buffer);
+        co_return true;
+    };
+    co_await parser.send_packet(std::move(packet), 0);
+    co_return result;
+}
+
+template <class T>
+auto bench_load(const std::string_view name, T sample) -> coop::Async<bool> {
+    auto packet = co_await encode(std::move(sample));
+    coop_unwrap(parsed, net::split_header(packet.body()));
+    const auto payload = parsed.second;
+    measure(std::format("serde::load {}", name), [payload](uint32_t) {
+        auto result = serde::load<net::BinaryFormat, T>(payload);
+        do_not_optimize(result);
+    });
+    co_return true;
+}
+
+// a client speaking the protocol directly over loopback
+struct Peer {
+    plink::loopback::ClientBackend backend;
+    net::PacketParser              parser;
+
+    auto connect(plink::loopback::ServerBackend& server) -> coop::Async<bool> {
+        backend.on_received = [this](PrependableBuffer buffer) -> coop::Async<void> {
+            co_await parser.callbacks.invoke(std::move(buffer));
+        };
+        parser.send_data = [this](PrependableBuffer buffer) { return backend.send(std::move(buffer)); };
+        coop_ensure(co_await backend.connect(server));
+        coop_ensure(co_await parser.receive_response<plink::proto::Success>(plink::proto::ActivateSession{}));
+        co_return true;
+    }
+};
+
+auto bench_codec() -> coop::Async<bool> {
+    namespace proto = plink::proto;
+
+    auto packet = co_await encode(proto::RegisterPad{"pad"});
+    measure("net::split_header", [&packet](uint32_t) {
+        auto result = net::split_header(packet.body());
+        do_not_optimize(result);
+    });
+
+    coop_ensure(co_await bench_load("ActivateSession", proto::ActivateSession{std::string(256, 'c')}));
+    coop_ensure(co_await bench_load("RegisterPad", proto::RegisterPad{"bench-pad"}));
+    coop_ensure(co_await bench_load("Link", proto::Link{"bench-pad", net::BytesArray(32)}));
+    coop_ensure(co_await bench_load("Auth", proto::Auth{"bench-pad", net::BytesArray(32)}));
+    coop_ensure(co_await bench_load("AuthResponse", proto::AuthResponse{"bench-pad", true}));
+    coop_ensure(co_await bench_load("RegisterGroupPad", proto::RegisterGroupPad{"bench-pad"}));
+    coop_ensure(co_await bench_load("ResumeToken", proto::ResumeToken{std::string(32, 't')}));
+    coop_ensure(co_await bench_load("Resume", proto::Resume{std::string(32, 't')}));
+    coop_ensure(co_await bench_load("RegisterChannel", proto::RegisterChannel{"bench-channel"}));
+    coop_ensure(co_await bench_load("UnregisterChannel", proto::UnregisterChannel{"bench-channel"}));
+    coop_ensure(co_await bench_load("Channels", proto::Channels{std::vector<std::string>(16, "bench-channel")}));
+    coop_ensure(co_await bench_load("RequestPad", proto::RequestPad{"bench-channel"}));
+    coop_ensure(co_await bench_load("PadCreated", proto::PadCreated{"bench-channel", "bench-pad"}));
+    coop_ensure(co_await bench_load("QueryChannels", proto::QueryChannels{"bench", "", 16}));
+    coop_ensure(co_await bench_load("ChannelsPage", proto::ChannelsPage{std::vector<std::string>(16, "bench-channel"), "bench-channel"}));
+    coop_ensure(co_await bench_load("ChannelsChanged", proto::ChannelsChanged{"bench-channel", true}));
+
+    // PacketParser::callbacks dispatch by type
+    constexpr auto type   = net::PacketType(0x7f);
+    auto           parser = net::PacketParser();
+    auto           count  = 0uz;
+
+    parser.callbacks.by_type[type] = [&count](net::Header /*header*/, PrependableBuffer /*buffer*/) -> coop::Async<bool> {
+        count += 1;
+        co_return true;
+    };
+    coop_ensure(co_await measure_async("PacketParser dispatch", [&parser](uint32_t) {
+        return parser.callbacks.invoke(net::Header{.type = type, .id = 0, .size = 0}, PrependableBuffer());
+    }));
+    do_not_optimize(count);
+    co_return true;
+}
+
+auto bench_peer_linker(coop::Runner& runner) -> coop::Async<bool> {
+    namespace proto = plink::proto;
+
+    const auto server  = plink::create_peer_linker();
+    const auto backend = new plink::loopback::ServerBackend(runner);
+    server->logger.set_name_and_detect_loglevel("plink");
+    server->runner       = &runner;
+    server->close_client = [backend](const net::ClientData& client) { backend->disconnect(client); };
+    plink::attach_backend(*server, backend);
+
+    coop_ensure(co_await measure_async("plink connect+activate+disconnect", [backend](uint32_t) -> coop::Async<bool> {
+        auto peer = Peer();
+        coop_ensure(co_await peer.connect(*backend));
+        co_return co_await peer.backend.finish();
+    }));
+
+    auto host  = Peer();
+    auto guest = Peer();
+    coop_ensure(co_await host.connect(*backend));
+    coop_ensure(co_await guest.connect(*backend));
+
+    coop_ensure(co_await measure_async("plink register+unregister pad", [&guest](uint32_t i) -> coop::Async<bool> {
+        coop_ensure(co_await guest.parser.receive_response<proto::Success>(proto::RegisterPad{std::format("pad-{}", i)}));
+        coop_ensure(co_await guest.parser.receive_response<proto::Success>(proto::UnregisterPad()));
+        co_return true;
+    }));
+
+    host.parser.callbacks.by_type[proto::Auth::pt] = [&host](const net::Header header, PrependableBuffer buffer) -> coop::Async<bool> {
+        constexpr auto error_value = false;
+        co_unwrap_v(request, (serde::load<net::BinaryFormat, proto::Auth>(buffer.body())));
+        co_return co_await host.parser.send_packet(proto::AuthResponse{request.requester_name, true}, header.id);
+    };
+    host.parser.callbacks.by_type[proto::Unlinked::pt] = [](net::Header /*header*/, PrependableBuffer /*buffer*/) -> coop::Async<bool> {
+        co_return true;
+    };
+    coop_ensure(co_await host.parser.receive_response<proto::Success>(proto::RegisterPad{"host"}));
+    coop_ensure(co_await guest.parser.receive_response<proto::Success>(proto::RegisterPad{"guest"}));
+
+    coop_ensure(co_await measure_async("plink link+unlink", [&guest](uint32_t) -> coop::Async<bool> {
+        coop_ensure(co_await guest.parser.receive_response<proto::Success>(proto::Link{"host", {}}));
+        coop_ensure(co_await guest.parser.receive_response<proto::Success>(proto::Unlink()));
+        co_return true;
+    }));
+
+    // one payload in flight at a time, so this is the relay latency
+    coop_ensure(co_await guest.parser.receive_response<proto::Success>(proto::Link{"host", {}}));
+    auto received                                     = false;
+    auto received_event                               = (coop::SingleEvent*)(nullptr);
+    host.parser.callbacks.by_type[proto::Payload::pt] = [&](net::Header /*header*/, PrependableBuffer /*buffer*/) -> coop::Async<bool> {
+        received = true;
+        if(received_event != nullptr) {
+            received_event->notify();
+        }
+        co_return true;
+    };
+    coop_ensure(co_await measure_async("plink relay 64B payload", [&](uint32_t) -> coop::Async<bool> {
+        auto buffer = PrependableBuffer();
+        buffer.append_object(std::array<std::byte, 64>());
+        received = false;
+        coop_ensure(co_await guest.parser.send_packet(proto::Payload::pt, std::move(buffer)));
+        if(!received) {
+            auto event     = coop::SingleEvent();
+            received_event = &event;
+            co_await event;
+            received_event = nullptr;
+        }
+        co_return true;
+    }));
+
+    co_await host.backend.finish();
+    co_await guest.backend.finish();
+
+    // memory held per idle linked session over loopback, which is not what a tcp server holds:
+    // there is no socket, receive or encryption state, while the client side of each connection and its two tasks are counted
+    // so the figures track the in-tree session, pad and registry state, not the footprint in production
+    auto idle = std::vector<Peer>(idle_pairs * 2);
+    for(auto i = 0uz; i < idle_pairs; i += 1) {
+        auto& peer                                     = idle[i * 2];
+        peer.parser.callbacks.by_type[proto::Auth::pt] = [&peer](const net::Header header, PrependableBuffer buffer) -> coop::Async<bool> {
+            constexpr auto error_value = false;
+            co_unwrap_v(request, (serde::load<net::BinaryFormat, proto::Auth>(buffer.body())));
+            co_return co_await peer.parser.send_packet(proto::AuthResponse{request.requester_name, true}, header.id);
+        };
+    }
+    const auto bytes    = plink::alloc_counter::bytes();
+    const auto resident = resident_bytes();
+    for(auto i = 0uz; i < idle_pairs; i += 1) {
+        auto& host  = idle[i * 2];
+        auto& guest = idle[i * 2 + 1];
+        coop_ensure(co_await host.connect(*backend));
+        coop_ensure(co_await guest.connect(*backend));
+        coop_ensure(co_await host.parser.receive_response<proto::Success>(proto::RegisterPad{std::format("idle-host-{}", i)}));
+        coop_ensure(co_await guest.parser.receive_response<proto::Success>(proto::RegisterPad{std::format("idle-guest-{}", i)}));
+        coop_ensure(co_await guest.parser.receive_response<proto::Success>(proto::Link{std::format("idle-host-{}", i), {}}));
+    }
+    std::println("{:<40} {:>10.1f} bytes/session", "plink idle linked session", double(plink::alloc_counter::bytes() - bytes) / idle.size());
+    // the first sweep only clears the activity flags
+    co_await server->trim_idle();
+    co_await server->trim_idle();
+    std::println("{:<40} {:>10.1f} bytes/session", "plink idle linked session, trimmed", double(plink::alloc_counter::bytes() - bytes) / idle.size());
+    // what the process really holds, including allocator overhead
+    const auto rss = double(resident_bytes() - resident) / idle.size();
+    std::println("{:<40} {:>10.1f} bytes/session", "plink idle linked session, rss", rss);
+    const auto within_budget = idle_budget == 0 || rss <= idle_budget;
+    if(!within_budget) {
+        std::println("idle session exceeds the budget of {} resident bytes", idle_budget);
+    }
+    for(auto& peer : idle) {
+        co_await peer.backend.finish();
+    }
+    co_return within_budget;
+}
+
+auto bench_channel_hub(coop::Runner& runner) -> coop::Async<bool> {
+    namespace proto = plink::proto;
+
+    const auto server  = plink::create_channel_hub();
+    const auto backend = new plink::loopback::ServerBackend(runner);
+    server->logger.set_name_and_detect_loglevel("chub");
+    server->runner       = &runner;
+    server->close_client = [backend](const net::ClientData& client) { backend->disconnect(client); };
+    plink::attach_backend(*server, backend);
+
+    auto sender   = Peer();
+    auto receiver = Peer();
+    coop_ensure(co_await sender.connect(*backend));
+    coop_ensure(co_await receiver.connect(*backend));
+
+    coop_ensure(co_await measure_async("chub register+unregister channel", [&sender](uint32_t i) -> coop::Async<bool> {
+        const auto name = std::format("channel-{}", i);
+        coop_ensure(co_await sender.parser.receive_response<proto::Success>(proto::RegisterChannel{name}));
+        coop_ensure(co_await sender.parser.receive_response<proto::Success>(proto::UnregisterChannel{name}));
+        co_return true;
+    }));
+
+    sender.parser.callbacks.by_type[proto::RequestPad::pt] = [&sender](const net::Header header, PrependableBuffer buffer) -> coop::Async<bool> {
+        constexpr auto error_value = false;
+        co_unwrap_v_mut(request, (serde::load<net::BinaryFormat, proto::RequestPad>(buffer.body())));
+        co_return co_await sender.parser.send_packet(proto::PadCreated{std::move(request.channel_name), "pad"}, header.id);
+    };
+    coop_ensure(co_await sender.parser.receive_response<proto::Success>(proto::RegisterChannel{"channel"}));
+
+    coop_ensure(co_await measure_async("chub request pad", [&receiver](uint32_t) -> coop::Async<bool> {
+        coop_ensure(co_await receiver.parser.receive_response<proto::PadCreated>(proto::RequestPad{"channel"}));
+        co_return true;
+    }));
+
+    co_await sender.backend.finish();
+    co_await receiver.backend.finish();
+    co_return true;
+}
+
+// a failed case ends its group, the other groups still run
+auto run(coop::Runner& runner) -> coop::Async<void> {
+    failed |= !co_await bench_codec();
+    failed |= !co_await bench_peer_linker(runner);
+    failed |= !co_await bench_channel_hub(runner);
+}
+} // namespace
+
+auto main(const int argc, const char* const argv[]) -> int {
+    {
+        auto parser = args::Parser<uint32_t>();
+        auto help   = false;
+        parser.kwflag(&help, {"-h", "--help"}, "print this help message", {.no_error_check = true});
+        parser.kwarg(&iterations, {"-n", "--iterations"}, "N", "iterations of each case", {.state = args::State::DefaultValue});
+        parser.kwarg(&idle_pairs, {"--idle-pairs"}, "N", "linked session pairs kept open for the idle memory case", {.state = args::State::DefaultValue});
+        parser.kwarg(&idle_budget, {"--idle-budget"}, "BYTES", "fail if an idle loopback session, client side included, holds more resident memory than this, 0 to disable", {.state = args::State::DefaultValue});
+        if(!parser.parse(argc, argv) || help) {
+            std::println("usage: plink-microbench {}", parser.get_help());
+            return 0;
+        }
+    }
+
+    auto runner = coop::Runner();
+    runner.push_task(run(runner));
+    runner.run();
+    return failed ? 1 : 0;
+}
@@ -1,9 +1,24 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <format>
+#include <functional>
+
 #include <coop/runner.hpp>
+#include <coop/single-event.hpp>
 #include <coop/task-handle.hpp>
 #include <coop/timer.hpp>
 
 #include "macros/assert.hpp"
+#include "macros/coop-unwrap.hpp"
+#include "plink/admission.hpp"
+#include "plink/buffer-util.hpp"
+#include "plink/loopback.hpp"
 #include "plink/peer-linker-client.hpp"
+#include "plink/protocol.hpp"
+#include "plink/server.hpp"
+#include "plink/session-key.hpp"
+#include "plink/sha256.hpp"
 #include "util/concat.hpp"
 #include "util/span.hpp"
 
@@ -43,12 +58,689 @@ auto start_client_2(Client& client) -> coop::Async<bool> {
 
 #include "common.cpp"
 
+namespace {
+namespace proto = plink::proto;
+
+using Bytes = std::vector<std::byte>;
+
+// connect() of a host returns only after a peer links, so it runs beside the peer
+struct Host {
+    bool              registered = false; // or failed before it
+    coop::SingleEvent registered_event;
+    bool              connected = false;
+    bool              done      = false;
+    coop::SingleEvent done_event;
+
+    // Backend is Client or PeerLinkerMuxPad
+    // args are copied into the task, so wrap references with std::ref
+    template <class Backend, class... Args>
+    auto run(Backend& backend, Args... args) -> coop::Async<void> {
+        backend.on_pad_created = [this] {
+            registered = true;
+            registered_event.notify();
+        };
+        connected = co_await backend.connect(std::move(args)...);
+        if(!registered) {
+            registered = true;
+            registered_event.notify();
+        }
+        done = true;
+        done_event.notify();
+    }
+
+    auto wait_registered() -> coop::Async<void> {
+        if(!registered) {
+            co_await registered_event;
+        }
+    }
+
+    auto wait_done() -> coop::Async<bool> {
+        if(!done) {
+            co_await done_event;
+        }
+        co_return connected;
+    }
+};
+
+auto make_payload(const size_t index, const size_t size) -> Bytes {
+    auto payload = Bytes(size, std::byte(index));
+    std::memcpy(payload.data(), &index, std::min(size, sizeof(index)));
+    return payload;
+}
+
+auto to_buffer(const Bytes& payload) -> PrependableBuffer {
+    auto buffer = PrependableBuffer();
+    plink::append_bytes(buffer, payload);
+    return buffer;
+}
+
+// on_received which stores the payloads
+auto collect(std::vector<Bytes>& received) {
+    return [&received](PrependableBuffer buffer) -> coop::Async<void> {
+        const auto body = buffer.body();
+        received.emplace_back(body.begin(), body.end());
+        co_return;
+    };
+}
+
+auto accept_any(std::string_view /*name*/, net::BytesRef /*secret*/) -> bool {
+    return true;
+}
+
+// polls with a deadline, so that a lost packet fails the test instead of hanging it
+auto wait_until(const std::function<bool()> done) -> coop::Async<bool> {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while(!done() && std::chrono::steady_clock::now() < deadline) {
+        co_await coop::sleep(std::chrono::milliseconds(10));
+    }
+    co_return done();
+}
+
+auto to_hex(const net::BytesRef bytes) -> std::string {
+    auto str = std::string();
+    for(const auto byte : bytes) {
+        str += std::format("{:02x}", int(byte));
+    }
+    return str;
+}
+
+// holds writes to one client, as a slow link would, so that its send queue fills up
+struct GatedBackend : plink::loopback::ServerBackend {
+    const net::ClientData* held   = nullptr;
+    coop::SingleEvent*     waiter = nullptr; // the held write, there is one at a time as writes to a session are serialized
+
+    auto send(const net::ClientData& client, PrependableBuffer buffer) -> coop::Async<bool> override {
+        if(&client == held) {
+            auto event = coop::SingleEvent();
+            waiter     = &event;
+            co_await event;
+        }
+        co_return co_await ServerBackend::send(client, std::move(buffer));
+    }
+
+    auto release() -> void {
+        held = nullptr;
+        if(waiter != nullptr) {
+            std::exchange(waiter, nullptr)->notify();
+        }
+    }
+
+    using ServerBackend::ServerBackend;
+};
+
+// a peer linker in this process, so that tests can see and change its state
+// the peers must be finished before this is destroyed
+struct LocalServer {
+    std::unique_ptr<plink::Server> server;
+    GatedBackend*                  backend; // owned by server
+
+    LocalServer(coop::Runner& runner)
+        : server(plink::create_peer_linker()),
+          backend(new GatedBackend(runner)) {
+        server->logger.set_name_and_detect_loglevel("plink");
+        server->runner       = &runner;
+        server->close_client = [backend = backend](const net::ClientData& client) { backend->disconnect(client); };
+        plink::attach_backend(*server, backend);
+    }
+};
+
+// a packet type no server handles, answered with Error
+struct Probe {
+    constexpr static auto pt = net::PacketType(0x7f);
+};
+
+// a client speaking the protocol directly to a LocalServer
+struct Peer {
+    plink::loopback::ClientBackend backend;
+    net::PacketParser              parser;
+    std::vector<Bytes>             received; // payloads
+    bool                           unlinked = false;
+    bool                           closed   = false;
+
+    // connects without activating, links to the pads of this peer are always accepted
+    auto open(plink::loopback::ServerBackend& server) -> coop::Async<bool> {
+        backend.on_received = [this](PrependableBuffer buffer) -> coop::Async<void> {
+            co_await parser.callbacks.invoke(std::move(buffer));
+        };
+        backend.on_closed                            = [this] { closed = true; };
+        parser.send_data                             = [this](PrependableBuffer buffer) { return backend.send(std::move(buffer)); };
+        parser.callbacks.by_type[proto::Payload::pt] = [this](net::Header /*header*/, PrependableBuffer buffer) -> coop::Async<bool> {
+            const auto body = buffer.body();
+            received.emplace_back(body.begin(), body.end());
+            co_return true;
+        };
+        parser.callbacks.by_type[proto::Unlinked::pt] = [this](net::Header /*header*/, PrependableBuffer /*buffer*/) -> coop::Async<bool> {
+            unlinked = true;
+            co_return true;
+        };
+        parser.callbacks.by_type[proto::Auth::pt] = [this](const net::Header header, PrependableBuffer buffer) -> coop::Async<bool> {
+            constexpr auto error_value = false;
+            co_unwrap_v(request, (serde::load<net::BinaryFormat, proto::Auth>(buffer.body())));
+            co_return co_await parser.send_packet(proto::AuthResponse{request.requester_name, true}, header.id);
+        };
+        co_return co_await backend.connect(server);
+    }
+
+    auto connect(plink::loopback::ServerBackend& server) -> coop::Async<bool> {
+        coop_ensure(co_await open(server));
+        coop_ensure(co_await parser.receive_response<proto::Success>(proto::ActivateSession{}));
+        co_return true;
+    }
+
+    auto send(const Bytes& payload) -> coop::Async<bool> {
+        return parser.send_packet(proto::Payload::pt, to_buffer(payload));
+    }
+
+    // the server handles the packets of a connection in order, so every packet sent before this one is done on return
+    auto sync() -> coop::Async<bool> {
+        co_await parser.receive_response<proto::Success>(Probe());
+        co_return !closed;
+    }
+};
+
+// fips 180-4 and rfc 4231 known answers for the hash behind certificates and admission
+auto sha256_test() -> bool {
+    constexpr auto error_value = false;
+
+    struct HashCase {
+        std::string      message;
+        std::string_view digest;
+    };
+    const auto hash_cases = std::array{
+        HashCase{"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        HashCase{"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        HashCase{"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+        HashCase{std::string(1000000, 'a'), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+    };
+    for(const auto& hash_case : hash_cases) {
+        const auto message = std::as_bytes(std::span(hash_case.message));
+        ensure_v(to_hex(plink::Sha256().update(message).finish()) == hash_case.digest, "sha-256 of {} bytes mismatched", message.size());
+        // the same message in uneven pieces, crossing block boundaries
+        auto ctx = plink::Sha256();
+        for(auto pos = 0uz, step = 1uz; pos < message.size(); pos += step, step = step * 2 + 1) {
+            ctx.update(message.subspan(pos, std::min(step, message.size() - pos)));
+        }
+        ensure_v(to_hex(ctx.finish()) == hash_case.digest, "split sha-256 of {} bytes mismatched", message.size());
+    }
+
+    struct HmacCase {
+        Bytes            key;
+        std::string_view message;
+        std::string_view digest;
+    };
+    const auto hmac_cases = std::array{
+        // rfc 4231 test cases 1, 2 and 6
+        HmacCase{Bytes(20, std::byte(0x0b)), "Hi There", "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7"},
+        HmacCase{copy(to_span("Jefe")), "what do ya want for nothing?", "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"},
+        HmacCase{Bytes(131, std::byte(0xaa)), "Test Using Larger Than Block-Size Key - Hash Key First", "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54"},
+    };
+    for(const auto& hmac_case : hmac_cases) {
+        const auto key = SessionKey(hmac_case.key);
+        // twice, the pre-keyed states must not be consumed
+        ensure_v(to_hex(key.compute_hash(hmac_case.message)) == hmac_case.digest, "hmac-sha-256 with {} byte key mismatched", hmac_case.key.size());
+        ensure_v(to_hex(key.compute_hash(hmac_case.message)) == hmac_case.digest, "hmac-sha-256 with {} byte key mismatched", hmac_case.key.size());
+    }
+    return true;
+}
+
+// every packet in a Batch must be small, and the Batch itself bounded
+auto is_bounded_batch(net::BytesRef packets) -> bool {
+    constexpr auto error_value = false;
+    ensure_v(packets.size() <= plink::proto::batch_size_limit);
+    for(auto count = 0uz; !packets.empty(); count += 1) {
+        ensure_v(count < plink::proto::batch_count_limit);
+        auto header = net::Header();
+        ensure_v(packets.size() >= sizeof(header));
+        std::memcpy(&header, packets.data(), sizeof(header));
+        const auto size = sizeof(header) + header.size;
+        ensure_v(size <= plink::proto::batch_packet_limit && size <= packets.size());
+        packets = packets.subspan(size);
+    }
+    return true;
+}
+
+// relays small payloads around a large one, which must not be merged, and checks the order
+auto batch_test(coop::Runner& runner, const bool accept_batch) -> coop::Async<bool> {
+    const auto name     = std::format("batch-{}", accept_batch);
+    auto       host     = Client();
+    auto       state    = Host();
+    auto       guest    = Client();
+    auto       received = std::vector<Bytes>();
+    auto       batches  = 0uz;
+    auto       bounded  = true;
+
+    host.on_auth_request = accept_any;
+    host.on_received     = collect(received);
+
+    const auto params = Client::Params{
+        .peer_linker_addr = "localhost",
+        .peer_linker_port = 8080,
+        .pad_name         = name,
+        .accept_batch     = accept_batch,
+    };
+    runner.push_task(state.run(host, params));
+    co_await state.wait_registered();
+    coop_ensure(co_await guest.connect({
+        .peer_linker_addr = "localhost",
+        .peer_linker_port = 8080,
+        .pad_name         = name + "-guest",
+        .peer_info        = Client::Params::PeerInfo{name, {}},
+    }));
+    coop_ensure(co_await state.wait_done());
+
+    // count the batches on their way to the usual handler
+    auto& callback = host.parser.callbacks.by_type[plink::proto::Batch::pt];
+    callback       = [&batches, &bounded, unpack = std::move(callback)](const net::Header header, PrependableBuffer buffer) -> coop::Async<bool> {
+        batches += 1;
+        bounded &= is_bounded_batch(buffer.body());
+        co_return unpack && co_await unpack(header, std::move(buffer));
+    };
+
+    // enough small payloads to overflow one batch
+    auto sent = std::vector<Bytes>();
+    for(auto i = 0uz; i < 600; i += 1) {
+        sent.push_back(make_payload(i, i == 300 ? 16 * 1024 : 256));
+    }
+    for(const auto& payload : sent) {
+        coop_ensure(co_await guest.send(to_buffer(payload)));
+    }
+    coop_ensure(co_await wait_until([&] { return received.size() >= sent.size(); }));
+    coop_ensure(received == sent, "payloads reordered or corrupted");
+    coop_ensure(bounded, "batch over the limits");
+    coop_ensure(accept_batch || batches == 0, "batch sent to a client which did not accept it");
+    std::println("batch_test accept_batch={} batches={}", accept_batch, batches);
+
+    coop_ensure(co_await guest.finish());
+    coop_ensure(co_await host.finish());
+    co_return true;
+}
+
+// two links sharing both connections, each payload must reach only its own peer
+auto mux_test(coop::Runner& runner) -> coop::Async<bool> {
+    using PeerInfo = Client::Params::PeerInfo;
+
+    auto mux1 = plink::PeerLinkerMux();
+    auto mux2 = plink::PeerLinkerMux();
+    coop_ensure(co_await mux1.connect({.peer_linker_addr = "localhost", .peer_linker_port = 8080}));
+    coop_ensure(co_await mux2.connect({.peer_linker_addr = "localhost", .peer_linker_port = 8080}));
+
+    auto hosts          = std::array<plink::PeerLinkerMuxPad, 2>();
+    auto guests         = std::array<plink::PeerLinkerMuxPad, 2>();
+    auto states         = std::array<Host, 2>();
+    auto host_received  = std::array<std::vector<Bytes>, 2>();
+    auto guest_received = std::array<std::vector<Bytes>, 2>();
+    for(auto i = 0uz; i < hosts.size(); i += 1) {
+        const auto name          = std::format("mux-{}", i);
+        hosts[i].on_auth_request = accept_any;
+        hosts[i].on_received     = collect(host_received[i]);
+        guests[i].on_received    = collect(guest_received[i]);
+        runner.push_task(states[i].run(hosts[i], std::ref(mux1), plink::PeerLinkerMuxPad::Params{.pad_name = name}));
+        co_await states[i].wait_registered();
+        coop_ensure(co_await guests[i].connect(mux2, {.pad_name = name + "-guest", .peer_info = PeerInfo{name, {}}}));
+        coop_ensure(co_await states[i].wait_done());
+    }
+
+    // forward both ways on both links
+    for(auto i = 0uz; i < hosts.size(); i += 1) {
+        coop_ensure(co_await guests[i].send(to_buffer(make_payload(i, 32))));
+        coop_ensure(co_await hosts[i].send(to_buffer(make_payload(i + 2, 32))));
+    }
+    coop_ensure(co_await wait_until([&] { return host_received[0].size() + host_received[1].size() + guest_received[0].size() + guest_received[1].size() >= 4; }));
+    for(auto i = 0uz; i < hosts.size(); i += 1) {
+        coop_ensure(host_received[i] == std::vector<Bytes>{make_payload(i, 32)}, "payload went to the wrong pad");
+        coop_ensure(guest_received[i] == std::vector<Bytes>{make_payload(i + 2, 32)}, "payload went to the wrong pad");
+    }
+
+    // closing one pad unlinks its peer and leaves the other link and the connections working
+    auto closed         = false;
+    guests[0].on_closed = [&closed] { closed = true; };
+    coop_ensure(co_await hosts[0].finish());
+    coop_ensure(co_await wait_until([&closed] { return closed; }), "peer of the closed pad not unlinked");
+    coop_ensure(co_await guests[1].send(to_buffer(make_payload(4, 32))));
+    coop_ensure(co_await wait_until([&] { return host_received[1].size() >= 2; }));
+    coop_ensure(host_received[1].back() == make_payload(4, 32));
+    coop_ensure(host_received[0].size() == 1, "payload reached a closed pad");
+
+    coop_ensure(co_await guests[0].finish());
+    coop_ensure(co_await guests[1].finish());
+    coop_ensure(co_await hosts[1].finish());
+    coop_ensure(co_await mux1.finish());
+    coop_ensure(co_await mux2.finish());
+    co_return true;
+}
+
+// a group pad broadcasts to every member, members talk to the host only
+auto group_test() -> coop::Async<bool> {
+    using PeerInfo = Client::Params::PeerInfo;
+
+    auto host             = Client();
+    auto members          = std::array<Client, 3>();
+    auto host_received    = std::vector<Bytes>();
+    auto members_received = std::array<std::vector<Bytes>, 3>();
+    host.on_auth_request  = accept_any;
+    host.on_received      = collect(host_received);
+    coop_ensure(co_await host.connect({
+        .peer_linker_addr = "localhost",
+        .peer_linker_port = 8080,
+        .pad_name         = "group",
+        .group            = true,
+    }));
+    for(auto i = 0uz; i < members.size(); i += 1) {
+        members[i].on_received = collect(members_received[i]);
+        coop_ensure(co_await members[i].connect({
+            .peer_linker_addr = "localhost",
+            .peer_linker_port = 8080,
+            .pad_name         = std::format("group-member-{}", i),
+            .peer_info        = PeerInfo{"group", {}},
+        }));
+    }
+    const auto received_by_all = [&members_received](const size_t count) {
+        return std::ranges::all_of(members_received, [count](const auto& received) { return received.size() >= count; });
+    };
+
+    // broadcast
+    coop_ensure(co_await host.send(to_buffer(make_payload(0, 32))));
+    coop_ensure(co_await wait_until([&] { return received_by_all(1); }));
+    for(const auto& received : members_received) {
+        coop_ensure(received == std::vector<Bytes>{make_payload(0, 32)});
+    }
+
+    // member to host
+    coop_ensure(co_await members[1].send(to_buffer(make_payload(1, 32))));
+    coop_ensure(co_await wait_until([&] { return !host_received.empty(); }));
+    coop_ensure(host_received == std::vector<Bytes>{make_payload(1, 32)});
+    coop_ensure(members_received[0].size() == 1 && members_received[2].size() == 1, "member payload reached other members");
+
+    // the rest keep receiving after a member leaves
+    // unlinking is answered once the server dropped it from the group, unlike a disconnect which it notices some time later
+    coop_ensure(co_await members[0].parser.receive_response<proto::Success>(proto::Unlink()));
+    coop_ensure(co_await members[0].finish());
+    coop_ensure(co_await host.send(to_buffer(make_payload(2, 32))));
+    coop_ensure(co_await wait_until([&] { return members_received[1].size() >= 2 && members_received[2].size() >= 2; }));
+    coop_ensure(members_received[1].back() == make_payload(2, 32) && members_received[2].back() == make_payload(2, 32));
+    coop_ensure(members_received[0].size() == 1, "payload reached a member which left");
+
+    coop_ensure(co_await members[1].finish());
+    coop_ensure(co_await members[2].finish());
+    coop_ensure(co_await host.finish());
+    co_return true;
+}
+
+// drops the host connection while the guest keeps sending, then resumes it
+// with overflow, more than the default backlog limit of 1 MiB is sent and the resume must fail
+// in process, so that the test can see when the server parked the session instead of sleeping for it
+auto resume_test(coop::Runner& runner, const bool overflow) -> coop::Async<bool> {
+    auto local = LocalServer(runner);
+    auto host  = Peer();
+    auto guest = Peer();
+    coop_ensure(co_await host.connect(*local.backend));
+    coop_ensure(co_await guest.connect(*local.backend));
+    coop_ensure(co_await host.parser.receive_response<proto::Success>(proto::RegisterPad{"resume-host"}));
+    coop_unwrap(token, co_await host.parser.receive_response<proto::ResumeToken>(proto::GetResumeToken()));
+    coop_ensure(co_await guest.parser.receive_response<proto::Success>(proto::RegisterPad{"resume-guest"}));
+    coop_ensure(co_await guest.parser.receive_response<proto::Success>(proto::Link{"resume-host", {}}));
+
+    // the backend forgets the connection right before the server parks its session, without suspending in between
+    local.backend->disconnect(host.backend.client);
+    coop_ensure(co_await wait_until([&] { return !local.backend->clients.contains(&host.backend.client); }));
+
+    auto sent = std::vector<Bytes>();
+    for(auto i = 0uz; i < (overflow ? 80 : 8); i += 1) {
+        sent.push_back(make_payload(i, 16 * 1024));
+        coop_ensure(co_await guest.send(sent.back()));
+    }
+    coop_ensure(co_await guest.sync(), "guest connection lost");
+
+    auto resumed = Peer();
+    coop_ensure(co_await resumed.open(*local.backend));
+    if(overflow) {
+        coop_ensure(!co_await resumed.parser.receive_response<proto::ResumeToken>(proto::Resume{token.token}), "resumed with a gap in the backlog");
+        coop_ensure(co_await wait_until([&guest] { return guest.unlinked; }), "peer of the lost session not unlinked");
+    } else {
+        // the backlog is delivered before the response
+        coop_ensure(co_await resumed.parser.receive_response<proto::ResumeToken>(proto::Resume{token.token}));
+        coop_ensure(resumed.received == sent, "backlog not replayed in order");
+
+        // the link keeps working
+        sent.push_back(make_payload(sent.size(), 32));
+        coop_ensure(co_await guest.send(sent.back()));
+        coop_ensure(co_await wait_until([&] { return resumed.received.size() >= sent.size(); }));
+        coop_ensure(resumed.received == sent);
+    }
+
+    coop_ensure(co_await guest.backend.finish());
+    coop_ensure(co_await resumed.backend.finish());
+    coop_ensure(co_await host.backend.finish());
+    co_return true;
+}
+
+// two members send to a group host whose first write is held, so the second payload finds the queue full
+auto queue_policy_test(coop::Runner& runner, const plink::QueuePolicy policy) -> coop::Async<bool> {
+    auto local                      = LocalServer(runner);
+    local.server->send_queue_limit  = 1024;
+    local.server->send_queue_policy = policy;
+    const auto& stats               = local.server->queue_stats;
+
+    auto host    = Peer();
+    auto members = std::array<Peer, 2>();
+    coop_ensure(co_await host.connect(*local.backend));
+    coop_ensure(co_await host.parser.receive_response<proto::Success>(proto::RegisterGroupPad{"policy-group"}));
+    for(auto i = 0uz; i < members.size(); i += 1) {
+        coop_ensure(co_await members[i].connect(*local.backend));
+        coop_ensure(co_await members[i].parser.receive_response<proto::Success>(proto::RegisterPad{std::format("policy-member-{}", i)}));
+        coop_ensure(co_await members[i].parser.receive_response<proto::Success>(proto::Link{"policy-group", {}}));
+    }
+
+    local.backend->held = &host.backend.client;
+    coop_ensure(co_await members[0].send(make_payload(0, 800)));
+    coop_ensure(co_await wait_until([&local] { return local.backend->waiter != nullptr; }));
+    coop_ensure(co_await members[1].send(make_payload(1, 800)));
+    switch(policy) {
+    case plink::QueuePolicy::Pause: {
+        // the sender waits for the held write, so its connection cannot be synced until released
+        const auto& session = *std::bit_cast<plink::Session*>(host.backend.client.data);
+        coop_ensure(co_await wait_until([&session] { return !session.space_waiters.empty(); }));
+        coop_ensure(stats.paused == 1);
+        local.backend->release();
+        coop_ensure(co_await wait_until([&host] { return host.received.size() >= 2; }));
+        coop_ensure(host.received == std::vector{make_payload(0, 800), make_payload(1, 800)}, "paused payload lost or reordered");
+    } break;
+    case plink::QueuePolicy::Drop: {
+        coop_ensure(co_await members[1].sync());
+        coop_ensure(stats.dropped == 1);
+        local.backend->release();
+        // the link stays
+        coop_ensure(co_await members[1].send(make_payload(2, 32)));
+        coop_ensure(co_await wait_until([&host] { return host.received.size() >= 2; }));
+        coop_ensure(host.received == std::vector{make_payload(0, 800), make_payload(2, 32)}, "dropped payload delivered");
+    } break;
+    case plink::QueuePolicy::Disconnect: {
+        coop_ensure(co_await members[1].sync());
+        coop_ensure(stats.disconnected == 1);
+        coop_ensure(co_await wait_until([&members] { return members[1].unlinked; }), "sender not unlinked");
+        local.backend->release();
+        // the other member is still linked
+        coop_ensure(co_await members[0].send(make_payload(2, 32)));
+        coop_ensure(co_await wait_until([&host] { return host.received.size() >= 2; }));
+        coop_ensure(host.received == std::vector{make_payload(0, 800), make_payload(2, 32)}, "payload of an unlinked member delivered");
+    } break;
+    }
+
+    for(auto& member : members) {
+        coop_ensure(co_await member.backend.finish());
+    }
+    coop_ensure(co_await host.backend.finish());
+    co_return true;
+}
+
+// token buckets at explicit times, and the buckets of plink::Admission
+// the admission rates are low enough that no token is refilled while the test runs
+auto admission_test() -> bool {
+    constexpr auto error_value = false;
+
+    const auto limit  = plink::RateLimit{.rate = 2, .burst = 3};
+    const auto start  = std::chrono::steady_clock::now();
+    auto       bucket = plink::TokenBucket();
+    for(auto i = 0; i < 3; i += 1) {
+        ensure_v(bucket.take(limit, start), "bucket did not start full");
+    }
+    ensure_v(!bucket.take(limit, start), "bucket exceeded its burst");
+    ensure_v(bucket.take(limit, start + std::chrono::milliseconds(500)), "bucket not refilled");
+    ensure_v(!bucket.take(limit, start + std::chrono::milliseconds(500)));
+    for(auto i = 0; i < 3; i += 1) {
+        ensure_v(bucket.take(limit, start + std::chrono::hours(1)));
+    }
+    ensure_v(!bucket.take(limit, start + std::chrono::hours(1)), "bucket refilled beyond its burst");
+
+    auto admission = plink::Admission();
+    ensure_v(admission.admit_accept() && admission.admit_accept(), "disabled limit refused");
+
+    admission.accept = {.rate = 0.001, .burst = 2};
+    ensure_v(admission.admit_accept() && admission.admit_accept());
+    ensure_v(!admission.admit_accept(), "accept beyond the burst");
+    ensure_v(admission.refused_accepts == 1);
+
+    const auto identity = [](const uint8_t n) {
+        auto identity = plink::Admission::Identity();
+        identity[0]   = std::byte(n);
+        return identity;
+    };
+    admission.activation     = {.rate = 0.001, .burst = 1};
+    admission.max_identities = 2;
+    ensure_v(admission.admit_activation(identity(1)));
+    ensure_v(!admission.admit_activation(identity(1)), "activation beyond the burst");
+    ensure_v(admission.admit_activation(identity(2)), "identities share a bucket");
+    ensure_v(!admission.admit_activation(identity(1))); // 1 is the most recently seen now
+    ensure_v(admission.admit_activation(identity(3)));  // evicts 2
+    ensure_v(admission.activation_buckets.size() == 2 && !admission.activation_index.contains(identity(2)), "least recently seen identity not evicted");
+    ensure_v(!admission.admit_activation(identity(1)), "recently seen identity evicted");
+    ensure_v(admission.admit_activation(identity(2)), "evicted identity not forgotten");
+    ensure_v(admission.refused_activations == 3);
+
+    admission.packet = {.rate = 0.001, .burst = 1};
+    auto buckets     = std::array<plink::TokenBucket, 2>();
+    ensure_v(admission.admit_packet(buckets[0]));
+    ensure_v(!admission.admit_packet(buckets[0]), "packet beyond the burst");
+    ensure_v(admission.admit_packet(buckets[1]), "sessions share a bucket");
+    ensure_v(admission.refused_packets == 1);
+    return true;
+}
+
+// a session beyond the accept burst gets one Error and is closed, the others are unaffected
+auto admission_refusal_test(coop::Runner& runner) -> coop::Async<bool> {
+    auto local                     = LocalServer(runner);
+    local.server->admission.accept = {.rate = 0.001, .burst = 1};
+
+    auto admitted = Peer();
+    auto refused  = Peer();
+    coop_ensure(co_await admitted.connect(*local.backend));
+    coop_ensure(co_await refused.open(*local.backend));
+    coop_ensure(!co_await refused.parser.receive_response<proto::Success>(proto::ActivateSession{}), "refused session activated");
+    coop_ensure(co_await wait_until([&refused] { return refused.closed; }), "refused session not closed");
+    coop_ensure(local.server->admission.refused_accepts == 1);
+    coop_ensure(co_await admitted.parser.receive_response<proto::Success>(proto::RegisterPad{"admitted"}));
+
+    coop_ensure(co_await refused.backend.finish());
+    coop_ensure(co_await admitted.backend.finish());
+    co_return true;
+}
+
+// prometheus text format, and the packet histograms which clients must not be able to add to
+auto metrics_test(coop::Runner& runner) -> coop::Async<bool> {
+    auto  registry  = plink::metrics::Registry();
+    auto& counter   = registry.counter("test_total", "a counter", "kind=\"a\"");
+    auto& gauge     = registry.gauge("test_gauge", "a gauge");
+    auto& histogram = registry.histogram("test_seconds", "a histogram", "kind=\"a\"");
+    registry.collectors.push_back([&gauge] { gauge.value = 2.5; });
+    counter.value = 3;
+    histogram.observe(std::chrono::duration<double>(0.0625));
+    histogram.observe(std::chrono::duration<double>(16)); // above every bound
+    constexpr auto expected = std::string_view(R"(# HELP test_total a counter
+# TYPE test_total counter
+test_total{kind="a"} 3
+# HELP test_gauge a gauge
+# TYPE test_gauge gauge
+test_gauge 2.5
+# HELP test_seconds a histogram
+# TYPE test_seconds histogram
+test_seconds_bucket{kind="a",le="0.0001"} 0
+test_seconds_bucket{kind="a",le="0.00025"} 0
+test_seconds_bucket{kind="a",le="0.0005"} 0
+test_seconds_bucket{kind="a",le="0.001"} 0
+test_seconds_bucket{kind="a",le="0.0025"} 0
+test_seconds_bucket{kind="a",le="0.005"} 0
+test_seconds_bucket{kind="a",le="0.01"} 0
+test_seconds_bucket{kind="a",le="0.025"} 0
+test_seconds_bucket{kind="a",le="0.05"} 0
+test_seconds_bucket{kind="a",le="0.1"} 1
+test_seconds_bucket{kind="a",le="0.25"} 1
+test_seconds_bucket{kind="a",le="0.5"} 1
+test_seconds_bucket{kind="a",le="1"} 1
+test_seconds_bucket{kind="a",le="2.5"} 1
+test_seconds_bucket{kind="a",le="5"} 1
+test_seconds_bucket{kind="a",le="10"} 1
+test_seconds_bucket{kind="a",le="+Inf"} 2
+test_seconds_sum{kind="a"} 16.0625
+test_seconds_count{kind="a"} 2
+)");
+    const auto rendered = registry.render();
+    coop_ensure(rendered == expected, "unexpected exposition:\n{}", rendered);
+
+    // packets of unknown types share one series
+    auto local = LocalServer(runner);
+    auto peer  = Peer();
+    coop_ensure(co_await peer.connect(*local.backend));
+    const auto series = local.server->packet_seconds.size();
+    coop_ensure(co_await peer.sync());
+    coop_ensure(co_await peer.sync()); // the first one is observed after its reply is sent
+    coop_ensure(local.server->packet_seconds.size() == series, "series added by a client");
+    coop_ensure(local.server->packet_seconds_other->count >= 1, "unknown packet not observed");
+    const auto exposition = local.server->metrics.render();
+    coop_ensure(exposition.contains("plink_packet_seconds_count{type=\"other\"}"));
+    coop_ensure(exposition.contains(std::format("plink_packet_seconds_count{{type=\"{}\"}} 1", int(proto::ActivateSession::pt))));
+    coop_ensure(!exposition.contains(std::format("type=\"{}\"", int(Probe::pt))), "series added by a client");
+
+    coop_ensure(co_await peer.backend.finish());
+    co_return true;
+}
+
+// the test server runs without --trace-dump, so no session may make it write files
+auto trace_dump_test() -> coop::Async<bool> {
+    auto client = plink::PeerLinkerMux();
+    coop_ensure(co_await client.connect({.peer_linker_addr = "localhost", .peer_linker_port = 8080}));
+    coop_ensure(!co_await client.parser.receive_response<plink::proto::Success>(plink::proto::DumpTrace()), "trace dump accepted without --trace-dump");
+    coop_ensure(co_await client.finish());
+    co_return true;
+}
+
+auto features_pass = false;
+
+auto run_tests(coop::Runner& runner) -> coop::Async<void> {
+    coop_ensure(sha256_test());
+    coop_ensure(admission_test());
+    coop_ensure(co_await batch_test(runner, false));
+    coop_ensure(co_await batch_test(runner, true));
+    coop_ensure(co_await mux_test(runner));
+    coop_ensure(co_await group_test());
+    coop_ensure(co_await resume_test(runner, false));
+    coop_ensure(co_await resume_test(runner, true));
+    coop_ensure(co_await queue_policy_test(runner, plink::QueuePolicy::Pause));
+    coop_ensure(co_await queue_policy_test(runner, plink::QueuePolicy::Drop));
+    coop_ensure(co_await queue_policy_test(runner, plink::QueuePolicy::Disconnect));
+    coop_ensure(co_await metrics_test(runner));
+    coop_ensure(co_await admission_refusal_test(runner));
+    coop_ensure(co_await trace_dump_test());
+    features_pass = true;
+}
+} // namespace
+
 auto main() -> int {
     auto runner = coop::Runner();
     runner.push_task(test());
+    runner.push_task(run_tests(runner));
     runner.run();
 
-    if(pass) {
+    if(pass && features_pass) {
         std::println("pass");
         return 0;
     } else {